@@ -1 +1,2 @@
-from .client import DickerBotClient
\ No newline at end of file
+from .client import DickerBotClient
+from .codec import decode_grayscale
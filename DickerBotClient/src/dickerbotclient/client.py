@@ -3,6 +3,23 @@ import websockets
 import base64
 import numpy as np
 import threading
+import struct
+from .codec import decode_grayscale
+
+PROTOCOL_VERSION = 3
+SUPPORTED_ENCODINGS = ("rice", "bin", "txt") # preferred first
+SENSOR_FIELDS = ("ax", "ay", "az", "gx", "gy", "gz", "t", "dL", "dF", "dR", "dB")
+SENSOR_FORMAT = struct.Struct("<7f4i") # protocol version 2, all channels
+SENSOR_CHANNELS = ( # bit n of the channel mask, in frame order
+    ("imu", struct.Struct("<6f"), ("ax", "ay", "az", "gx", "gy", "gz")),
+    ("temperature", struct.Struct("<f"), ("t",)),
+    ("ranging", struct.Struct("<4i4B4B"), ("dL", "dF", "dR", "dB", "sL", "sF", "sR", "sB", "cL", "cF", "cR", "cB")),
+)
+DISTANCE_SENSORS = ("left", "front", "right", "back")
+LINK_FIELDS = ("rx_bytes", "rx_frames", "tx_bytes", "tx_frames", "parse_failures", "errors", "overruns", "high_water", "reconnects")
+SOCKET_LINK_FIELDS = LINK_FIELDS + ("rtt_p50_us", "rtt_p90_us", "rtt_p99_us", "wifi_disconnects", "rssi_dbm")
+FLIGHT_RECORD_FORMAT = struct.Struct("<IB3xQ7f4i4x")
+FLIGHT_RECORD_TYPES = {1: "sensor", 2: "control", 3: "motion", 4: "link", 5: "trigger"}
 
 class DickerBotClient:
     def __init__(self):
@@ -11,8 +28,26 @@ class DickerBotClient:
         self.running = False
         self.lock = threading.Lock()
 
-        self.sensor_data = {}
-        self.latest_image = None
+        self.robot_id = None
+        self.subscriptions = set()
+        self.last_robot_id = None
+        self.requested_rates = (0, 0) # sensor, camera in Hz, 0 for the robot's maximum
+        self.hello_sent = set() # robot ids a hello was sent to since they last connected
+        self.outbox = [] # frames queued by message handlers, sent by the listener
+
+        self.capabilities = {} # robot id -> advertised capabilities
+        self.negotiated = {} # robot id -> negotiated encoding and rates
+        self.boot_timing = {} # robot id -> latest boot and reconnect timing
+
+        self.sensor_data = {} # robot id -> latest sensor data
+        self.latest_image = {} # robot id -> latest image
+        self.queue_status = {} # robot id -> latest motion queue status
+        self.task_stats = {} # robot id -> latest controller task stats
+        self.sample_rates = {} # robot id -> sensor channel rates applied by the controller
+        self.range_filters = {} # robot id -> distance sensor -> filter settings applied by the controller
+        self.link_health = {} # robot id -> link name -> latest counters
+        self.flight_records = {} # robot id -> flight records received so far
+        self.flight_recordings = {} # robot id -> last complete flight recording
 
     '''
     Connects to the websocket server asynchronously.
@@ -23,16 +58,27 @@ class DickerBotClient:
         async with websockets.connect(uri) as ws:
             self.ws = ws
             self.running = True
+            for robot_id, stream in self.subscriptions:
+                await self.ws.send(f"SU,{robot_id},{stream};")
+            if self.robot_id is not None:
+                self._queue_hello(self.robot_id)
             await self._listen()
 
     '''
     Connects to the websocket server.
     :param ip: The IP address of the websocket server.
     :param port: The port of the websocket server.
+    :param robot_id: The MAC address of the robot to follow, None for every robot on the host.
+    :param streams: The streams to subscribe to ("SD" sensor data, "ID" image data, "QS" motion queue status, "TS" task stats).
+    :param sensor_rate: The sensor data rate to request in Hz, None for the robot's maximum.
+    :param camera_rate: The image data rate to request in Hz, None for the robot's maximum.
     :return: None
     '''
-    def connect(self, ip, port=8765):
+    def connect(self, ip, port=8765, robot_id=None, streams=("SD", "ID", "QS", "TS"), sensor_rate=None, camera_rate=None):
         uri = f"ws://{ip}:{port}"
+        self.robot_id = robot_id
+        self.requested_rates = (sensor_rate or 0, camera_rate or 0)
+        self.subscriptions = {(robot_id or "*", stream) for stream in tuple(streams) + ("HL", "NG", "BT", "SR", "RF", "LH")}
         threading.Thread(target=asyncio.run, args=(self._connect(uri),), daemon=True).start()
 
     '''
@@ -44,6 +90,8 @@ class DickerBotClient:
             try:
                 message = await self.ws.recv()
                 self._handle_message(message)
+                while self.outbox:
+                    await self.ws.send(self.outbox.pop(0))
             except Exception as e:
                 self.running = False
                 break
@@ -54,10 +102,41 @@ class DickerBotClient:
     :return: None
     '''
     def _handle_message(self, message):
-        if message.startswith("SD,"):
+        if isinstance(message, bytes):
+            if message.startswith(b"SD,"):
+                self._parse_binary_sensor_data(message)
+            elif message.startswith(b"ID,"):
+                self._parse_binary_image_data(message)
+            elif message.startswith(b"FR,"):
+                self._parse_flight_records(message)
+        elif message.startswith("HL,"):
+            self._parse_hello(message)
+        elif message.startswith("NG,"):
+            self._parse_negotiation(message)
+        elif message.startswith("BT,"):
+            self._parse_boot_timing(message)
+        elif message.startswith("SD,"):
             self._parse_sensor_data(message)
         elif message.startswith("ID,"):
             self._parse_image_data(message)
+        elif message.startswith("QS,"):
+            self._parse_queue_status(message)
+        elif message.startswith("TS,"):
+            self._parse_task_stats(message)
+        elif message.startswith("SR,"):
+            self._parse_sample_rates(message)
+        elif message.startswith("RF,"):
+            self._parse_range_filter(message)
+        elif message.startswith("LH,"):
+            self._parse_link_health(message)
+        elif message.startswith("FE,"):
+            self._parse_flight_recording_end(message)
+
+        # Say hello to every robot heard from, so it can switch to the fastest shared encoding
+        header = message[:32].decode(errors="ignore") if isinstance(message, bytes) else message[:32]
+        robot_id = header.split(",")[1].rstrip(";") if header.count(",") >= 1 else None
+        if robot_id and robot_id not in self.hello_sent and self.robot_id in (None, robot_id):
+            self._queue_hello(robot_id)
 
     '''
     Parses sensor data from the incoming message.
@@ -69,18 +148,50 @@ class DickerBotClient:
             message = message.strip()
             
             data_string = message[3:].strip(';')
+            robot_id, data_string = data_string.split(",", 1)
             data_values = data_string.split(",")
             data = list(map(float, data_values))
 
-            with self.lock:
-                self.sensor_data = {
-                    "ax": data[0], "ay": data[1], "az": data[2],
-                    "gx": data[3], "gy": data[4], "gz": data[5],
-                    "t": data[6], "dL": data[7], "dF": data[8], "dR": data[9], "dB": data[10]
-                }
+            self._store_sensor_data(robot_id, dict(zip(SENSOR_FIELDS, data)))
         except ValueError:
             pass
 
+    '''
+    Parses binary sensor data from the incoming message.
+    :param message: The incoming message, "SD,robot_id," followed by the channel mask and the values of each channel in it.
+    :return: None
+    '''
+    def _parse_binary_sensor_data(self, message):
+        try:
+            _, robot_id, payload = message.split(b",", 2)
+            robot_id = robot_id.decode()
+
+            with self.lock:
+                negotiated = self.negotiated.get(robot_id)
+            if negotiated is None or negotiated["version"] < 3:
+                self._store_sensor_data(robot_id, dict(zip(SENSOR_FIELDS, SENSOR_FORMAT.unpack(payload))))
+                return
+
+            channels, offset, data = payload[0], 1, {}
+            for bit, (_, channel_format, names) in enumerate(SENSOR_CHANNELS):
+                if channels & (1 << bit):
+                    data.update(zip(names, channel_format.unpack_from(payload, offset)))
+                    offset += channel_format.size
+            self._store_sensor_data(robot_id, data)
+        except (ValueError, IndexError, struct.error):
+            pass
+
+    '''
+    Stores decoded sensor data, keeping the latest value of channels not in this frame.
+    :param robot_id: The robot the data came from.
+    :param data: Dict of the received values, any of ax, ay, az, gx, gy, gz, t, dL, dF, dR, dB.
+    :return: None
+    '''
+    def _store_sensor_data(self, robot_id, data):
+        with self.lock:
+            self.sensor_data.setdefault(robot_id, {}).update(data)
+            self.last_robot_id = robot_id
+
     '''
     Parses image data from the incoming message.
     :param message: The incoming message.
@@ -88,30 +199,348 @@ class DickerBotClient:
     '''
     def _parse_image_data(self, message):
         try:
-            parts = message.split(",", 1)
+            parts = message.split(",", 2)
 
-            image_data = base64.b64decode(parts[1].rstrip(";"))
+            image_data = base64.b64decode(parts[2].rstrip(";"))
 
             with self.lock:
-                self.latest_image = np.frombuffer(image_data, dtype=np.uint8).reshape((96, 96))
+                self.latest_image[parts[1]] = np.frombuffer(image_data, dtype=np.uint8).reshape((96, 96))
+                self.last_robot_id = parts[1]
         except Exception as e:
             pass
 
+    '''
+    Parses binary image data from the incoming message.
+    :param message: The incoming message, "ID,robot_id," followed by the raw or losslessly compressed pixels.
+    :return: None
+    '''
+    def _parse_binary_image_data(self, message):
+        try:
+            _, robot_id, payload = message.split(b",", 2)
+            robot_id = robot_id.decode()
+
+            with self.lock:
+                negotiated = self.negotiated.get(robot_id)
+            if negotiated is not None and negotiated["encoding"] == "rice":
+                image = decode_grayscale(payload)
+            else:
+                image = np.frombuffer(payload, dtype=np.uint8).reshape((96, 96))
+
+            with self.lock:
+                self.latest_image[robot_id] = image
+                self.last_robot_id = robot_id
+        except ValueError:
+            pass
+
+    '''
+    Queues a hello to a robot, advertising what this client supports.
+    :param robot_id: The robot to say hello to.
+    :return: None
+    '''
+    def _queue_hello(self, robot_id):
+        sensor_rate, camera_rate = self.requested_rates
+        self.hello_sent.add(robot_id)
+        self.outbox.append(f"HL,{robot_id},{PROTOCOL_VERSION},{'|'.join(SUPPORTED_ENCODINGS)},{sensor_rate},{camera_rate};")
+
+    '''
+    Parses a robot's capability advertisement, sent whenever it connects.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_hello(self, message):
+        try:
+            fields = message.strip().strip(';').split(",")
+            robot_id = fields[1]
+
+            with self.lock:
+                self.capabilities[robot_id] = {
+                    "version": int(fields[2]), "encodings": fields[3].split("|"), "camera_formats": fields[4].split("|"),
+                    "max_sensor_rate": int(fields[5]), "max_camera_rate": int(fields[6]),
+                    "controller_version": int(fields[7]), "controller_capabilities": [c for c in fields[8].split("|") if c]
+                }
+
+            # The robot has restarted its protocol, negotiate again
+            self.hello_sent.discard(robot_id)
+        except (ValueError, IndexError):
+            pass
+
+    '''
+    Parses the result of a negotiation with a robot.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_negotiation(self, message):
+        try:
+            fields = message.strip().strip(';').split(",")
+
+            with self.lock:
+                self.negotiated[fields[1]] = {
+                    "version": int(fields[2]), "encoding": fields[3], "camera_format": fields[4],
+                    "sensor_rate": int(fields[5]), "camera_rate": int(fields[6])
+                }
+        except (ValueError, IndexError):
+            pass
+
+    '''
+    Parses boot and reconnect timing from the incoming message.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_boot_timing(self, message):
+        try:
+            fields = message.strip().strip(';').split(",")
+
+            with self.lock:
+                self.boot_timing[fields[1]] = {
+                    "wifi_ms": int(fields[2]), "socket_ms": int(fields[3]), "first_frame_ms": int(fields[4]),
+                    "reconnect_ms": int(fields[5]), "cached": fields[6] == "1"
+                }
+        except (ValueError, IndexError):
+            pass
+
+    '''
+    Parses motion queue status from the incoming message.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_queue_status(self, message):
+        try:
+            robot_id, depth, completed = message.strip().strip(';').split(",")[1:4]
+
+            with self.lock:
+                self.queue_status[robot_id] = {"depth": int(depth), "completed": int(completed)}
+        except ValueError:
+            pass
+
+    '''
+    Parses controller task stats from the incoming message.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_task_stats(self, message):
+        try:
+            fields = message.strip().strip(';').split(",")
+            robot_id, values = fields[1], list(map(int, fields[2:]))
+
+            with self.lock:
+                self.task_stats[robot_id] = {
+                    task: {"cpu_percent": values[2 * i] / 10, "stack_free": values[2 * i + 1]}
+                    for i, task in enumerate(("actuation", "imu", "ranging", "comms", "motor")) if 2 * i + 1 < len(values)
+                }
+        except (ValueError, IndexError):
+            pass
+
+    '''
+    Parses a chunk of flight records from the incoming binary message.
+    :param message: The incoming message, "FR,robot_id," followed by packed records.
+    :return: None
+    '''
+    def _parse_flight_records(self, message):
+        try:
+            _, robot_id, payload = message.split(b",", 2)
+            robot_id = robot_id.decode()
+            records = []
+            for sequence, record_type, timestamp_us, *fields in FLIGHT_RECORD_FORMAT.iter_unpack(payload):
+                records.append({
+                    "sequence": sequence, "type": FLIGHT_RECORD_TYPES.get(record_type, record_type),
+                    "timestamp_us": timestamp_us, "values": fields[:7], "ints": fields[7:]
+                })
+
+            with self.lock:
+                self.flight_records.setdefault(robot_id, []).extend(records)
+        except (ValueError, struct.error):
+            pass
+
+    '''
+    Completes a flight recording dump from the incoming message.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_flight_recording_end(self, message):
+        robot_id = message.strip().strip(';').split(",")[1]
+        with self.lock:
+            self.flight_recordings[robot_id] = self.flight_records.pop(robot_id, [])
+
+    '''
+    Resolves which robot a call refers to.
+    :param robot_id: The requested robot id, None for the followed (or most recently heard) robot.
+    :return: The robot id.
+    '''
+    def _resolve_robot_id(self, robot_id):
+        if robot_id is not None:
+            return robot_id
+        return self.robot_id if self.robot_id is not None else self.last_robot_id
+
+    '''
+    Returns the ids of the robots data has been received from.
+    :return: List of robot ids.
+    '''
+    def get_robots(self):
+        with self.lock:
+            return sorted(set(self.sensor_data) | set(self.latest_image))
+
     '''
     Returns the latest sensor data.
+    :param robot_id: The robot to get data from, None for the followed robot.
     :return: The latest sensor data.
     '''
-    def get_sensor_data(self):
+    def get_sensor_data(self, robot_id=None):
         with self.lock:
-            return self.sensor_data.copy()
+            return self.sensor_data.get(self._resolve_robot_id(robot_id), {}).copy()
 
     '''
     Returns the latest image data.
+    :param robot_id: The robot to get data from, None for the followed robot.
     :return: The latest image data.
     '''
-    def get_image_data(self):
+    def get_image_data(self, robot_id=None):
+        with self.lock:
+            image = self.latest_image.get(self._resolve_robot_id(robot_id))
+            return image.copy() if image is not None else None
+
+    '''
+    Returns what a robot advertised and what was negotiated with it.
+    :param robot_id: The robot to get the capabilities of, None for the followed robot.
+    :return: Dict with "advertised" and "negotiated" entries, each None until received.
+    '''
+    def get_capabilities(self, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        with self.lock:
+            return {"advertised": self.capabilities.get(robot_id), "negotiated": self.negotiated.get(robot_id)}
+
+    '''
+    Returns how long the robot took to start streaming, reported each time it connects.
+    :param robot_id: The robot to get the timing of, None for the followed robot.
+    :return: Dict with "wifi_ms", "socket_ms" and "first_frame_ms" since power-on, "reconnect_ms" for the
+             last outage (0 if none) and "cached" if the cached access point and lease were used.
+    '''
+    def get_boot_timing(self, robot_id=None):
+        with self.lock:
+            return self.boot_timing.get(self._resolve_robot_id(robot_id), {}).copy()
+
+    '''
+    Returns the latest motion queue status.
+    :param robot_id: The robot to get the status of, None for the followed robot.
+    :return: Dict with "depth" (pending segments, including the running one) and "completed" (segments finished since boot).
+    '''
+    def get_queue_status(self, robot_id=None):
+        with self.lock:
+            return self.queue_status.get(self._resolve_robot_id(robot_id), {}).copy()
+
+    '''
+    Parses the sensor channel rates applied by a robot's controller.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_sample_rates(self, message):
+        try:
+            robot_id, imu, temperature, ranging = message.strip().strip(';').split(",")[1:5]
+
+            with self.lock:
+                self.sample_rates[robot_id] = {"imu": int(imu), "temperature": int(temperature), "ranging": int(ranging)}
+        except ValueError:
+            pass
+
+    '''
+    Parses the filter settings of one distance sensor, as applied by a robot's controller.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_range_filter(self, message):
+        try:
+            robot_id, sensor, window, max_rate, min_range, max_range = message.strip().strip(';').split(",")[1:7]
+
+            with self.lock:
+                self.range_filters.setdefault(robot_id, {})[DISTANCE_SENSORS[int(sensor)]] = {
+                    "window": int(window), "max_rate": int(max_rate), "min_range": int(min_range), "max_range": int(max_range)
+                }
+        except (ValueError, IndexError):
+            pass
+
+    '''
+    Parses the counters of one of a robot's links.
+    :param message: The incoming message.
+    :return: None
+    '''
+    def _parse_link_health(self, message):
+        try:
+            fields = message.strip().strip(';').split(",")
+            robot_id, link, values = fields[1], fields[2], list(map(int, fields[3:]))
+            names = SOCKET_LINK_FIELDS if link == "socket" else LINK_FIELDS
+
+            with self.lock:
+                self.link_health.setdefault(robot_id, {})[link] = dict(zip(names, values))
+        except (ValueError, IndexError):
+            pass
+
+    '''
+    Returns the latest controller task stats, reported once per second.
+    :param robot_id: The robot to get the stats of, None for the followed robot.
+    :return: Dict of task name ("actuation", "imu", "ranging", "comms", "motor") to {"cpu_percent", "stack_free"}.
+    '''
+    def get_task_stats(self, robot_id=None):
+        with self.lock:
+            return dict(self.task_stats.get(self._resolve_robot_id(robot_id), {}))
+
+    '''
+    Returns the sampling rate of each sensor channel, as applied by the robot.
+    :param robot_id: The robot to get the rates of, None for the followed robot.
+    :return: Dict with "imu", "temperature" and "ranging" rates in Hz (0 = off), empty until reported.
+    '''
+    def get_sample_rates(self, robot_id=None):
+        with self.lock:
+            return self.sample_rates.get(self._resolve_robot_id(robot_id), {}).copy()
+
+    '''
+    Sets the sampling rate of each sensor channel. Each channel is sent only when due, at its own rate.
+    :param imu: The accelerometer and gyroscope rate in Hz, 0 to turn off, None to leave unchanged.
+    :param temperature: The temperature rate in Hz, 0 to turn off, None to leave unchanged.
+    :param ranging: The distance sensor rate in Hz, 0 to turn off, None to leave unchanged.
+    :param robot_id: The robot to configure, None for the followed robot.
+    :return: None
+    '''
+    def set_sample_rates(self, imu=None, temperature=None, ranging=None, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            rates = ",".join(str(-1 if rate is None else int(rate)) for rate in (imu, temperature, ranging))
+            asyncio.run(self._send_message(f"SR,{robot_id},{rates};"))
+
+    '''
+    Returns the latest link health counters, reported once per second. Counters are totals since boot.
+    :param robot_id: The robot to get the counters of, None for the followed robot.
+    :return: Dict of link ("controller" and "uart" for each end of the serial link, "socket") to counters:
+        rx_bytes, rx_frames, tx_bytes, tx_frames, parse_failures, errors, overruns, high_water, reconnects,
+        and for the socket also rtt_p50_us, rtt_p90_us, rtt_p99_us, wifi_disconnects and rssi_dbm.
+    '''
+    def get_link_health(self, robot_id=None):
+        with self.lock:
+            return {link: dict(counters) for link, counters in self.link_health.get(self._resolve_robot_id(robot_id), {}).items()}
+
+    '''
+    Returns the distance filter settings of each sensor, as applied by the robot.
+    :param robot_id: The robot to get the settings of, None for the followed robot.
+    :return: Dict of sensor ("left", "front", "right", "back") to {"window", "max_rate", "min_range", "max_range"}.
+    '''
+    def get_range_filters(self, robot_id=None):
         with self.lock:
-            return self.latest_image.copy() if self.latest_image is not None else None
+            return {sensor: dict(settings) for sensor, settings in self.range_filters.get(self._resolve_robot_id(robot_id), {}).items()}
+
+    '''
+    Configures the robot's distance filters: a sliding median, a rate-of-change gate and a valid range.
+    :param window: Samples in the sliding median (1-9, 1 disables it), None to leave unchanged.
+    :param max_rate: Largest believable change in cm/s, 0 disables the gate, None to leave unchanged.
+    :param min_range: Shortest valid distance in cm, None to leave unchanged.
+    :param max_range: Longest valid distance in cm, None to leave unchanged.
+    :param sensor: The sensor to configure ("left", "front", "right", "back"), None for all.
+    :param robot_id: The robot to configure, None for the followed robot.
+    :return: None
+    '''
+    def set_range_filter(self, window=None, max_rate=None, min_range=None, max_range=None, sensor=None, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            index = -1 if sensor is None else DISTANCE_SENSORS.index(sensor)
+            settings = ",".join(str(-1 if value is None else int(value)) for value in (window, max_rate, min_range, max_range))
+            asyncio.run(self._send_message(f"RF,{robot_id},{index},{settings};"))
 
     '''
     Sends control data to the websocket server.
@@ -121,9 +550,9 @@ class DickerBotClient:
     :param right_wheel_direction: Direction of the right wheel
     :return: None
     '''
-    async def _send_control_data(self, left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction):
+    async def _send_control_data(self, robot_id, left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction):
         if self.ws and self.running:
-            message = f"CD,{left_wheel_speed},{left_wheel_direction},{right_wheel_speed},{right_wheel_direction};"
+            message = f"CD,{robot_id},{left_wheel_speed},{left_wheel_direction},{right_wheel_speed},{right_wheel_direction};"
             await self.ws.send(message)
 
     '''
@@ -132,11 +561,114 @@ class DickerBotClient:
     :param left_wheel_direction: Direction of the left wheel
     :param right_wheel_speed: Speed of the right wheel.
     :param right_wheel_direction: Direction of the right wheel
+    :param robot_id: The robot to control, None for the followed robot.
+    :return: None
+    '''
+    def set_control_data(self, left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            asyncio.run(self._send_control_data(robot_id, left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction))
+
+    '''
+    Sends a batch of timed wheel states to the robot's motion queue.
+    Segments run back to back on the robot; the wheels stop when the queue runs empty.
+    :param segments: List of (duration_ms, left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction).
+    :param mode: "A" to append to the queue, "R" to replace it.
+    :param robot_id: The robot to control, None for the followed robot.
+    :return: None
+    '''
+    def queue_motion(self, segments, mode="A", robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            batch = "".join(f",{int(duration)},{ls},{ld},{rs},{rd}" for duration, ls, ld, rs, rd in segments)
+            asyncio.run(self._send_message(f"MQ,{robot_id},{mode}{batch};"))
+
+    '''
+    Clears the robot's motion queue and stops the wheels.
+    :param robot_id: The robot to control, None for the followed robot.
+    :return: None
+    '''
+    def flush_motion(self, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            asyncio.run(self._send_message(f"MQ,{robot_id},F;"))
+
+    '''
+    Freezes the robot's flight recorder, preserving the history up to now.
+    :param robot_id: The robot to freeze, None for the followed robot.
+    :return: None
+    '''
+    def freeze_flight_recorder(self, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            asyncio.run(self._send_message(f"FF,{robot_id};"))
+
+    '''
+    Resumes recording on the robot's flight recorder after a freeze.
+    :param robot_id: The robot to arm, None for the followed robot.
+    :return: None
+    '''
+    def arm_flight_recorder(self, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            asyncio.run(self._send_message(f"FA,{robot_id};"))
+
+    '''
+    Freezes the robot's flight recorder and requests its contents.
+    The recording becomes available from get_flight_recording once the dump completes.
+    The robot resumes recording after the dump, so no arm_flight_recorder call is needed.
+    :param robot_id: The robot to dump, None for the followed robot.
+    :return: None
+    '''
+    def request_flight_recording(self, robot_id=None):
+        robot_id = self._resolve_robot_id(robot_id)
+        if self.ws and self.running and robot_id is not None:
+            self.subscribe(robot_id, ("FR", "FE"))
+            with self.lock:
+                self.flight_records[robot_id] = []
+                self.flight_recordings.pop(robot_id, None)
+            asyncio.run(self._send_message(f"FD,{robot_id};"))
+
+    '''
+    Returns the last complete flight recording.
+    :param robot_id: The robot to get the recording of, None for the followed robot.
+    :return: List of records, oldest first, or None if no dump has completed. Each record has
+             "sequence", "type" (sensor, control, motion, link or trigger), "timestamp_us", "values" and "ints".
+    '''
+    def get_flight_recording(self, robot_id=None):
+        with self.lock:
+            return self.flight_recordings.get(self._resolve_robot_id(robot_id))
+
+    '''
+    Sends a raw frame to the websocket server.
+    :param message: The frame to send.
+    :return: None
+    '''
+    async def _send_message(self, message):
+        if self.ws and self.running:
+            await self.ws.send(message)
+
+    '''
+    Subscribes to streams of a robot.
+    :param robot_id: The robot to subscribe to, "*" for every robot.
+    :param streams: The streams to subscribe to ("SD" sensor data, "ID" image data, "*" for all).
+    :return: None
+    '''
+    def subscribe(self, robot_id, streams=("SD", "ID")):
+        self.subscriptions.update((robot_id, stream) for stream in streams)
+        if self.ws and self.running:
+            asyncio.run(self._send_message(f"SU,{robot_id},{'|'.join(streams)};"))
+
+    '''
+    Unsubscribes from streams of a robot.
+    :param robot_id: The robot to unsubscribe from, "*" for every robot.
+    :param streams: The streams to unsubscribe from.
     :return: None
     '''
-    def set_control_data(self, left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction):
+    def unsubscribe(self, robot_id, streams=("SD", "ID")):
+        self.subscriptions.difference_update((robot_id, stream) for stream in streams)
         if self.ws and self.running:
-            asyncio.run(self._send_control_data(left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction))
+            asyncio.run(self._send_message(f"US,{robot_id},{'|'.join(streams)};"))
 
     '''
     Disconnects from the websocket server.
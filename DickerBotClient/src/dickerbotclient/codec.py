@@ -0,0 +1,82 @@
+import numpy as np
+
+# Must match GrayscaleCodec.cpp in the communicator
+HEADER_SIZE = 4
+ESCAPE_LENGTH = 16
+MAX_K = 7
+ADAPT_RESET = 32
+
+'''
+Predicts a pixel from its left, upper and upper-left neighbours (median edge detector).
+:param left: The pixel to the left.
+:param up: The pixel above.
+:param up_left: The pixel above and to the left.
+:return: The predicted value.
+'''
+def _predict(left, up, up_left):
+    low, high = (left, up) if left < up else (up, left)
+    if up_left >= high:
+        return low
+    if up_left <= low:
+        return high
+    return left + up - up_left
+
+'''
+Decodes a losslessly compressed grayscale frame from the communicator.
+:param data: The encoded frame, uint16 width and height followed by the coded residuals.
+:return: The frame as a (height, width) uint8 array.
+:raises ValueError: If the data is truncated or malformed.
+'''
+def decode_grayscale(data):
+    if len(data) < HEADER_SIZE:
+        raise ValueError("truncated header")
+    width = int.from_bytes(data[0:2], "little")
+    height = int.from_bytes(data[2:4], "little")
+
+    # A string of bits lets str.find and int() do the bit-level work in C
+    payload = data[HEADER_SIZE:]
+    bits = bin(int.from_bytes(payload, "big"))[2:].zfill(len(payload) * 8) if payload else ""
+    escape = "1" * ESCAPE_LENGTH
+    position = 0
+    total = len(bits)
+
+    pixels = [0] * (width * height)
+    total_sum, count = 4, 1
+    for y in range(height):
+        row = y * width
+        for x in range(width):
+            k = 0
+            while k < MAX_K and (count << k) < total_sum:
+                k += 1
+
+            if bits.startswith(escape, position):
+                position += ESCAPE_LENGTH
+                if position + 8 > total:
+                    raise ValueError("truncated residual")
+                value = int(bits[position:position + 8], 2)
+                position += 8
+            else:
+                end = bits.find("0", position)
+                if end < 0 or end + 1 + k > total:
+                    raise ValueError("truncated residual")
+                value = (end - position) << k
+                if k:
+                    value |= int(bits[end + 1:end + 1 + k], 2)
+                position = end + 1 + k
+
+            if y == 0:
+                predicted = 128 if x == 0 else pixels[x - 1]
+            elif x == 0:
+                predicted = pixels[row - width]
+            else:
+                predicted = _predict(pixels[row + x - 1], pixels[row + x - width], pixels[row + x - width - 1])
+            residual = -((value + 1) >> 1) if value & 1 else value >> 1
+            pixels[row + x] = (predicted + residual) & 0xFF
+
+            total_sum += value
+            count += 1
+            if count == ADAPT_RESET:
+                total_sum >>= 1
+                count >>= 1
+
+    return np.array(pixels, dtype=np.uint8).reshape((height, width))
@@ -7,10 +7,6 @@
 
 #include "DickerBotCommunicator.h"
 
-// Vars for controlling frequency of updates (currently 1000/33 = 30 Hz)
-unsigned long lastUpdateTime = 0; 
-const int updateInterval = 33;
-
 // Create instance of class
 DickerBotCommunicator dickerBotCommunicator;
 
@@ -20,29 +16,12 @@ void setup() {
 
     // Initialize the communicator
     dickerBotCommunicator.Begin();
+
+    // Run controller and socket traffic as tasks on separate cores (sensor frames up to 100 Hz)
+    dickerBotCommunicator.StartPipeline();
 }
 
 void loop() {
-    // Get current time
-    unsigned long currentTime = millis();
-    
-    // Update on set interval
-    if (currentTime - lastUpdateTime >= updateInterval) {
-        lastUpdateTime = currentTime;
-
-        // Send data to socket if connected
-        if (dickerBotCommunicator.GetConnectionStatus()) {
-            dickerBotCommunicator.SendSensorDataToSocket();
-            dickerBotCommunicator.SendCameraDataToSocket();
-        }
-        else {
-            dickerBotCommunicator.CheckCommunicatorButton();
-        }
-    }
-
-    // Get updates from controller
-    dickerBotCommunicator.ReceiveDataFromController();
-
-    // Get updates from socket
-    dickerBotCommunicator.HandleWebSocket(); 
+    // All work happens in the pipeline tasks
+    vTaskDelete(NULL);
 }
\ No newline at end of file
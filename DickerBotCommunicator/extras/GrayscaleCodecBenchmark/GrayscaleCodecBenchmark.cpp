@@ -0,0 +1,77 @@
+/*
+    GrayscaleCodecBenchmark.cpp - Measures GrayscaleCodec on recorded frames, on Linux.
+    Released into the public domain
+
+    Build and run from this directory:
+        g++ -O2 -I../../src GrayscaleCodecBenchmark.cpp ../../src/GrayscaleCodec.cpp -o GrayscaleCodecBenchmark
+        ./GrayscaleCodecBenchmark frames.raw [width height]
+
+    frames.raw is raw 8-bit frames back to back (96x96 by default), e.g. recorded with the client by
+    appending bot.get_image_data().tobytes() to a file. Every frame is checked to decode exactly.
+*/
+
+#include "GrayscaleCodec.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+int main(int argc, char** argv) {
+    if (argc != 2 && argc != 4) {
+        fprintf(stderr, "usage: %s frames.raw [width height]\n", argv[0]);
+        return 1;
+    }
+    uint16_t width = argc == 4 ? atoi(argv[2]) : 96;
+    uint16_t height = argc == 4 ? atoi(argv[3]) : 96;
+    size_t frameSize = (size_t)width * height;
+
+    FILE* file = fopen(argv[1], "rb");
+    if (!file || frameSize == 0) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> frames;
+    uint8_t chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        frames.insert(frames.end(), chunk, chunk + read);
+    }
+    fclose(file);
+
+    size_t frameCount = frames.size() / frameSize;
+    if (frameCount == 0) {
+        fprintf(stderr, "no complete %ux%u frames in %s\n", width, height, argv[1]);
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> encoded(frameCount, std::vector<uint8_t>(GrayscaleCodec::MaxEncodedSize(width, height)));
+    std::vector<uint8_t> decoded(frameSize);
+    size_t encodedTotal = 0;
+
+    auto encodeStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frameCount; i++) {
+        size_t length = GrayscaleCodec::Encode(&frames[i * frameSize], width, height, encoded[i].data(), encoded[i].size());
+        encoded[i].resize(length);
+        encodedTotal += length;
+    }
+    double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count();
+
+    auto decodeStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frameCount; i++) {
+        uint16_t decodedWidth, decodedHeight;
+        if (!GrayscaleCodec::Decode(encoded[i].data(), encoded[i].size(), decoded.data(), decoded.size(), decodedWidth, decodedHeight) ||
+            memcmp(decoded.data(), &frames[i * frameSize], frameSize) != 0) {
+            fprintf(stderr, "frame %zu did not round-trip\n", i);
+            return 1;
+        }
+    }
+    double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - decodeStart).count();
+
+    double megabytes = (double)frameCount * frameSize / 1e6;
+    printf("frames:      %zu (%ux%u)\n", frameCount, width, height);
+    printf("ratio:       %.3f (%.0f bytes/frame)\n", (double)frameCount * frameSize / encodedTotal, (double)encodedTotal / frameCount);
+    printf("encode:      %.1f MB/s (%.1f us/frame)\n", megabytes / encodeSeconds, encodeSeconds * 1e6 / frameCount);
+    printf("decode:      %.1f MB/s (%.1f us/frame)\n", megabytes / decodeSeconds, decodeSeconds * 1e6 / frameCount);
+    return 0;
+}
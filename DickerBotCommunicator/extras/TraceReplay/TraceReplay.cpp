@@ -0,0 +1,442 @@
+/*
+    TraceReplay.cpp - Replays recorded DickerBot link traffic through the message handling code, on Linux.
+    Released into the public domain
+
+    Build and run from this directory:
+        g++ -O2 -I../../src -I../../../DickerBotController/src TraceReplay.cpp ../../src/CommunicatorProtocol.cpp \
+            ../../src/GrayscaleCodec.cpp ../../../DickerBotController/src/ControllerProtocol.cpp -o TraceReplay
+        ./TraceReplay trace.dbt [--speed N] [--dump decoded.txt] [--expect decoded.txt]
+
+    Messages to the controller go through ControllerProtocol, messages to the communicator through
+    CommunicatorProtocol, and camera frames from the robot through GrayscaleCodec, exactly as on the
+    boards. --speed replays N times faster than recorded (0, the default, as fast as possible) and reports
+    how late messages were handled. Every decoded message is written as one line of text; --dump saves
+    the lines and --expect compares them with a saved run, reporting where the output diverges.
+
+    Trace file: "DBTRACE1", then records of uint32 delta_us (since the previous record), uint8 link,
+    uint8 flags, uint8 endpoint, uint16 length (little-endian) and the message. See trace_capture.py
+    for the controller link and the host's --trace option for the socket links.
+*/
+
+#include "CommunicatorProtocol.h"
+#include "ControllerProtocol.h"
+#include "GrayscaleCodec.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char TRACE_MAGIC[8] = {'D', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+static const size_t RECORD_HEADER_SIZE = 9;
+enum TraceLink { TRACE_LINK_UART = 0, TRACE_LINK_ROBOT_SOCKET, TRACE_LINK_CLIENT_SOCKET, NUM_TRACE_LINKS };
+enum TraceFlags { TRACE_UPSTREAM = 1, TRACE_BINARY = 2, TRACE_GAP = 4 };  // Upstream is from the controller towards the clients
+static const char* const LINK_NAMES[NUM_TRACE_LINKS] = {"uart", "robot", "client"};
+static const int NUM_DISTANCE_SENSORS = 4;
+static const int MOTION_QUEUE_SIZE = 64;
+
+struct TraceRecord {
+    uint64_t time_us;  // Since the start of the trace
+    uint8_t link;
+    uint8_t flags;
+    uint8_t endpoint;
+    std::vector<uint8_t> data;
+};
+
+struct MessageStats {
+    uint32_t count = 0;
+    uint32_t failures = 0;
+    double total_us = 0;
+};
+
+// Per-robot decoding state, as kept by the communicator and the client
+struct ReplayState {
+    SensorData sensorState;
+    std::string encoding = "txt";
+};
+
+static uint32_t Fnv1a(const uint8_t* data, size_t length, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool LoadTrace(const char* path, std::vector<TraceRecord> &records) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    char magic[sizeof(TRACE_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        fclose(file);
+        return false;
+    }
+    uint64_t time_us = 0;
+    uint8_t header[RECORD_HEADER_SIZE];
+    while (fread(header, 1, RECORD_HEADER_SIZE, file) == RECORD_HEADER_SIZE) {
+        TraceRecord record;
+        time_us += header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+        record.time_us = time_us;
+        record.link = header[4];
+        record.flags = header[5];
+        record.endpoint = header[6];
+        record.data.resize(header[7] | (header[8] << 8));
+        if (fread(record.data.data(), 1, record.data.size(), file) != record.data.size()) {
+            break;  // Capture was cut off mid-record
+        }
+        records.push_back(std::move(record));
+    }
+    fclose(file);
+    return true;
+}
+
+// Splits "PREFIX,robot_id,rest" after the prefix, returning rest or nullptr
+static const char* SkipRobotId(const char* fields) {
+    const char* comma = strchr(fields, ',');
+    return comma != nullptr ? comma + 1 : nullptr;
+}
+
+static bool DecodeToController(const std::string &message, std::string &decoded) {
+    const char* fields = message.c_str() + 3;
+    char line[256];
+    if (message.compare(0, 3, "CD,") == 0) {
+        WheelCommand command;
+        if (!ControllerProtocol::ParseControlData(fields, command)) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "%d,%d,%d,%d", command.left_wheel_speed, command.left_wheel_direction, command.right_wheel_speed, command.right_wheel_direction);
+        decoded += line;
+    }
+    else if (message.compare(0, 3, "MQ,") == 0) {
+        char mode;
+        MotionSegment segments[MOTION_QUEUE_SIZE];
+        int numSegments = ControllerProtocol::ParseMotionQueueData(fields, mode, segments, MOTION_QUEUE_SIZE);
+        if (numSegments < 0) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "%c,%d", mode, numSegments);
+        decoded += line;
+        for (int i = 0; i < numSegments; i++) {
+            const MotionSegment &segment = segments[i];
+            snprintf(line, sizeof(line), ",%u:%d:%d:%d:%d", segment.duration_ms, segment.left_wheel_speed, segment.left_wheel_direction, segment.right_wheel_speed, segment.right_wheel_direction);
+            decoded += line;
+        }
+    }
+    else if (message.compare(0, 3, "SR,") == 0) {
+        int rates[3];
+        if (!ControllerProtocol::ParseSensorRates(fields, rates)) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "%d,%d,%d", rates[0], rates[1], rates[2]);
+        decoded += line;
+    }
+    else if (message.compare(0, 3, "RF,") == 0) {
+        RangeFilterSettings settings;
+        if (!ControllerProtocol::ParseRangeFilterData(fields, settings, NUM_DISTANCE_SENSORS)) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "%d,%d,%d,%d,%d", settings.sensor, settings.window, settings.max_rate_cm_s, settings.min_cm, settings.max_cm);
+        decoded += line;
+    }
+    else if (message.compare(0, 3, "HL,") == 0 || message.compare(0, 3, "RD,") == 0 || message.compare(0, 3, "WD,") == 0) {
+        decoded += fields;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+static bool DecodeFromController(const std::string &message, ReplayState &state, std::string &decoded) {
+    const char* fields = message.c_str() + 3;
+    char line[256];
+    if (message.compare(0, 3, "SD,") == 0) {
+        int channels;
+        if (!CommunicatorProtocol::ParseSensorData(fields, state.sensorState, channels)) {
+            return false;
+        }
+        const SensorData &frame = state.sensorState;
+        snprintf(line, sizeof(line), "%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%d,%d,%d,%d,%u,%u,%u,%u,%u,%u,%u,%u", channels,
+                 frame.ax, frame.ay, frame.az, frame.gx, frame.gy, frame.gz, frame.t, frame.dL, frame.dF, frame.dR, frame.dB,
+                 frame.rangeStatus[0], frame.rangeStatus[1], frame.rangeStatus[2], frame.rangeStatus[3],
+                 frame.rangeConfidence[0], frame.rangeConfidence[1], frame.rangeConfidence[2], frame.rangeConfidence[3]);
+        decoded += line;
+    }
+    else if (message.compare(0, 3, "HL,") == 0) {
+        ControllerInfo info;
+        if (!CommunicatorProtocol::ParseControllerHello(fields, info)) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "%d,%s,%d", info.version, info.capabilities, info.max_sensor_hz);
+        decoded += line;
+    }
+    else if (message.compare(0, 3, "QS,") == 0 || message.compare(0, 3, "TS,") == 0 || message.compare(0, 3, "SR,") == 0 ||
+             message.compare(0, 3, "RF,") == 0 || message.compare(0, 3, "LH,") == 0 || message.compare(0, 3, "WD,") == 0) {
+        decoded += fields;  // Passed through to the socket untouched
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+static bool DecodeFromSocket(const std::string &message, std::string &decoded) {
+    const char* fields = message.c_str() + 3;
+    char line[256];
+    if (message.compare(0, 3, "CD,") == 0) {
+        char robotId[CommunicatorProtocol::ROBOT_ID_LENGTH];
+        ControlData control;
+        if (!CommunicatorProtocol::ParseControlData(fields, robotId, control)) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "%s,%d,%d,%d,%d", robotId, control.left_wheel_speed, control.left_wheel_direction, control.right_wheel_speed, control.right_wheel_direction);
+        decoded += line;
+    }
+    else if (message.compare(0, 3, "HL,") == 0) {
+        const char* hello = SkipRobotId(fields);
+        ClientHello parsed;
+        if (hello == nullptr || !CommunicatorProtocol::ParseClientHello(hello, parsed)) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "%d,%s,%d,%d", parsed.version, parsed.encodings, parsed.sensor_hz, parsed.camera_hz);
+        decoded += line;
+    }
+    else if (message.size() >= 3 && message[2] == ',') {
+        decoded += fields;  // Motion queue, rates, filter and flight recorder requests pass through
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+static bool DecodeToSocket(const TraceRecord &record, const std::string &message, ReplayState &state, std::string &decoded) {
+    char line[256];
+    if (!(record.flags & TRACE_BINARY)) {
+        if (message.compare(0, 3, "NG,") == 0) {
+            // Camera frames after this use the agreed encoding
+            const char* fields = SkipRobotId(message.c_str() + 3);
+            const char* encoding = fields != nullptr ? strchr(fields, ',') : nullptr;
+            if (encoding != nullptr) {
+                state.encoding = std::string(encoding + 1, strcspn(encoding + 1, ",;"));
+            }
+        }
+        if (message.compare(0, 3, "ID,") == 0) {
+            snprintf(line, sizeof(line), "base64 %zu", message.size());  // Too long to compare line by line
+            decoded += line;
+        }
+        else {
+            decoded += message.c_str() + 3;
+        }
+        return true;
+    }
+
+    // Binary frames: "PREFIX,robot_id," then the payload
+    const uint8_t* data = record.data.data();
+    size_t length = record.data.size();
+    const uint8_t* second = (const uint8_t*)memchr(data + 3, ',', length > 3 ? length - 3 : 0);
+    if (second == nullptr) {
+        return false;
+    }
+    const uint8_t* payload = second + 1;
+    size_t payloadLength = length - (payload - data);
+    if (message.compare(0, 3, "ID,") == 0 && state.encoding == "rice") {
+        static uint8_t pixels[640 * 480];
+        uint16_t width, height;
+        if (!GrayscaleCodec::Decode(payload, payloadLength, pixels, sizeof(pixels), width, height)) {
+            return false;
+        }
+        snprintf(line, sizeof(line), "rice %ux%u %08x", width, height, Fnv1a(pixels, (size_t)width * height));
+    }
+    else {
+        snprintf(line, sizeof(line), "bin %zu %08x", payloadLength, Fnv1a(payload, payloadLength));
+    }
+    decoded += line;
+    return true;
+}
+
+static double Percentile(std::vector<double> &values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+int main(int argc, char** argv) {
+    const char* tracePath = nullptr;
+    const char* dumpPath = nullptr;
+    const char* expectPath = nullptr;
+    double speed = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dumpPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc) {
+            expectPath = argv[++i];
+        }
+        else if (tracePath == nullptr && argv[i][0] != '-') {
+            tracePath = argv[i];
+        }
+        else {
+            tracePath = nullptr;
+            break;
+        }
+    }
+    if (tracePath == nullptr) {
+        fprintf(stderr, "usage: %s trace.dbt [--speed N] [--dump decoded.txt] [--expect decoded.txt]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceRecord> records;
+    if (!LoadTrace(tracePath, records)) {
+        fprintf(stderr, "cannot read %s\n", tracePath);
+        return 1;
+    }
+    if (records.empty()) {
+        fprintf(stderr, "no records in %s\n", tracePath);
+        return 1;
+    }
+
+    std::map<int, ReplayState> states;  // By link and endpoint
+    std::map<std::string, MessageStats> messageStats;  // By link, direction and prefix
+    std::vector<std::string> output;
+    std::vector<double> latencies;
+    std::vector<double> lateness;
+    size_t totalBytes = 0;
+    uint32_t gaps = 0;
+    uint32_t hash = 2166136261u;
+
+    auto start = std::chrono::steady_clock::now();
+    for (const TraceRecord &record : records) {
+        if (speed > 0) {
+            auto due = start + std::chrono::microseconds((int64_t)(record.time_us / speed));
+            std::this_thread::sleep_until(due);
+            lateness.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - due).count());
+        }
+        gaps += (record.flags & TRACE_GAP) ? 1 : 0;
+        totalBytes += record.data.size();
+        bool upstream = record.flags & TRACE_UPSTREAM;
+        ReplayState &state = states[record.link * 256 + record.endpoint];
+
+        // UART records carry ';'-terminated messages, socket records one frame each
+        std::vector<std::string> messages;
+        if (record.link == TRACE_LINK_UART) {
+            std::string text(record.data.begin(), record.data.end());
+            size_t begin = 0;
+            while (begin < text.size()) {
+                size_t end = text.find(';', begin);
+                end = end == std::string::npos ? text.size() : end;
+                if (end > begin) {
+                    messages.push_back(text.substr(begin, end - begin));
+                }
+                begin = end + 1;
+            }
+        }
+        else {
+            size_t textLength = (record.flags & TRACE_BINARY) ? std::min<size_t>(record.data.size(), 32) : record.data.size();
+            std::string text(record.data.begin(), record.data.begin() + textLength);
+            if (!text.empty() && text.back() == ';') {
+                text.pop_back();
+            }
+            messages.push_back(text);
+        }
+
+        for (const std::string &message : messages) {
+            std::string decoded = std::string(LINK_NAMES[record.link < NUM_TRACE_LINKS ? record.link : (uint8_t)TRACE_LINK_CLIENT_SOCKET]) + (upstream ? "> " : "< ") + message.substr(0, 2) + " ";
+            auto handleStart = std::chrono::steady_clock::now();
+            bool valid = false;
+            if (record.link == TRACE_LINK_UART) {
+                valid = upstream ? DecodeFromController(message, state, decoded) : DecodeToController(message, decoded);
+            }
+            else if (record.link == TRACE_LINK_ROBOT_SOCKET) {
+                valid = upstream ? DecodeToSocket(record, message, state, decoded) : DecodeFromSocket(message, decoded);
+            }
+            else {
+                // The host only routes client traffic, record it without decoding
+                valid = true;
+                decoded += std::to_string(record.data.size());
+            }
+            double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - handleStart).count();
+
+            if (!valid) {
+                decoded += "!";
+            }
+            MessageStats &stats = messageStats[decoded.substr(0, decoded.find(' ', decoded.find(' ') + 1))];
+            stats.count++;
+            stats.failures += valid ? 0 : 1;
+            stats.total_us += elapsed;
+            latencies.push_back(elapsed);
+            hash = Fnv1a((const uint8_t*)decoded.data(), decoded.size(), hash);
+            output.push_back(decoded);
+        }
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double traceSeconds = records.back().time_us / 1e6;
+
+    printf("%zu records, %zu messages, %zu bytes, %u gaps\n", records.size(), output.size(), totalBytes, gaps);
+    printf("recorded %.2f s, replayed in %.3f s (%.1fx real time)\n", traceSeconds, wallSeconds, wallSeconds > 0 ? traceSeconds / wallSeconds : 0);
+    printf("throughput %.0f messages/s, %.2f MB/s\n", output.size() / wallSeconds, totalBytes / wallSeconds / 1e6);
+    std::vector<double> sorted = latencies;
+    printf("handling latency us: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n", Percentile(sorted, 0.5), Percentile(sorted, 0.9), Percentile(sorted, 0.99), Percentile(sorted, 1.0));
+    if (speed > 0) {
+        printf("lateness us at %.1fx: p50 %.0f, p99 %.0f, max %.0f\n", speed, Percentile(lateness, 0.5), Percentile(lateness, 0.99), Percentile(lateness, 1.0));
+    }
+    for (const auto &entry : messageStats) {
+        printf("  %-12s %8u messages %6u failed %8.2f us mean\n", entry.first.c_str(), entry.second.count, entry.second.failures, entry.second.total_us / entry.second.count);
+    }
+    printf("decoded output hash %08x\n", hash);
+
+    if (dumpPath != nullptr) {
+        FILE* dump = fopen(dumpPath, "w");
+        if (!dump) {
+            fprintf(stderr, "cannot write %s\n", dumpPath);
+            return 1;
+        }
+        for (const std::string &line : output) {
+            fprintf(dump, "%s\n", line.c_str());
+        }
+        fclose(dump);
+    }
+
+    if (expectPath != nullptr) {
+        FILE* expect = fopen(expectPath, "r");
+        if (!expect) {
+            fprintf(stderr, "cannot read %s\n", expectPath);
+            return 1;
+        }
+        std::vector<std::string> expected;
+        char line[4096];
+        while (fgets(line, sizeof(line), expect)) {
+            expected.push_back(std::string(line, strcspn(line, "\n")));
+        }
+        fclose(expect);
+
+        size_t divergent = 0;
+        size_t common = std::min(expected.size(), output.size());
+        for (size_t i = 0; i < common; i++) {
+            if (expected[i] != output[i]) {
+                if (divergent < 10) {
+                    printf("divergence at message %zu:\n  expected %s\n  got      %s\n", i + 1, expected[i].c_str(), output[i].c_str());
+                }
+                divergent++;
+            }
+        }
+        divergent += std::max(expected.size(), output.size()) - common;
+        if (expected.size() != output.size()) {
+            printf("expected %zu messages, got %zu\n", expected.size(), output.size());
+        }
+        printf("%zu divergent messages\n", divergent);
+        return divergent == 0 ? 0 : 2;
+    }
+    return 0;
+}
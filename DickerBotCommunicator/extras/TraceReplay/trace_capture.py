@@ -0,0 +1,102 @@
+'''
+trace_capture.py - Captures the DickerBot's controller-communicator serial link over the controller's USB port.
+Released into the public domain
+
+Usage:
+    python3 trace_capture.py /dev/ttyUSB0 uart.dbt [--baud 921600] [--seconds 60]
+
+Switches the controller's trace capture on (raising the USB baud rate so both directions of the
+link fit), writes every message to a trace file for TraceReplay until the time is up or Ctrl-C,
+then switches capture off again.
+'''
+
+import argparse
+import struct
+import sys
+import time
+import serial
+
+TRACE_MAGIC = b"DBTRACE1"
+TRACE_LINK_UART = 0
+TRACE_GAP = 4
+SYNC = b"\xdb\x7e"
+DEVICE_HEADER = struct.Struct("<IBH")  # timestamp_us, flags, length, after the sync bytes
+FILE_HEADER = struct.Struct("<IBBBH")  # delta_us, link, flags, endpoint, length
+CONSOLE_BAUD = 115200
+
+'''
+Switches the controller's capture on or off and moves the port to the new baud rate.
+:param port: The open serial port, at the controller's current baud rate.
+:param enabled: Whether to capture.
+:param baud: The baud rate to continue at.
+:return: None
+'''
+def set_capture(port, enabled, baud):
+    port.write(f"TC,{int(enabled)},{baud};".encode())
+    port.flush()
+    time.sleep(0.1)  # Let the controller acknowledge and switch
+    port.baudrate = baud
+    port.reset_input_buffer()
+
+'''
+Reads device records from the port and writes them to the trace file.
+:param port: The open serial port, with capture on.
+:param trace: The trace file, open for binary writing.
+:param seconds: How long to capture for, None until Ctrl-C.
+:return: Tuple of (records, gaps) written.
+'''
+def capture(port, trace, seconds):
+    buffer = bytearray()
+    last_timestamp = None
+    records = 0
+    gaps = 0
+    end = time.monotonic() + seconds if seconds else None
+    try:
+        while end is None or time.monotonic() < end:
+            buffer += port.read(max(1, port.in_waiting))
+            while True:
+                start = buffer.find(SYNC)
+                if start < 0:
+                    del buffer[:max(0, len(buffer) - 1)]  # Console text, keep a possible half sync
+                    break
+                if len(buffer) < start + len(SYNC) + DEVICE_HEADER.size:
+                    del buffer[:start]
+                    break
+                timestamp, flags, length = DEVICE_HEADER.unpack_from(buffer, start + len(SYNC))
+                payload_start = start + len(SYNC) + DEVICE_HEADER.size
+                if len(buffer) < payload_start + length:
+                    del buffer[:start]
+                    break
+
+                delta = 0 if last_timestamp is None else (timestamp - last_timestamp) & 0xFFFFFFFF
+                last_timestamp = timestamp
+                trace.write(FILE_HEADER.pack(delta, TRACE_LINK_UART, flags, 0, length))
+                trace.write(buffer[payload_start:payload_start + length])
+                records += 1
+                gaps += 1 if flags & TRACE_GAP else 0
+                del buffer[:payload_start + length]
+    except KeyboardInterrupt:
+        pass
+    return records, gaps
+
+def main():
+    parser = argparse.ArgumentParser(description="Capture the controller-communicator link to a trace file.")
+    parser.add_argument("port", help="The controller's USB serial port")
+    parser.add_argument("trace", help="The trace file to write")
+    parser.add_argument("--baud", type=int, default=921600, help="USB baud rate while capturing")
+    parser.add_argument("--seconds", type=float, default=None, help="Capture duration, default until Ctrl-C")
+    args = parser.parse_args()
+
+    port = serial.Serial(args.port, CONSOLE_BAUD, timeout=0.1)
+    with open(args.trace, "wb") as trace:
+        trace.write(TRACE_MAGIC)
+        set_capture(port, True, args.baud)
+        try:
+            records, gaps = capture(port, trace, args.seconds)
+        finally:
+            set_capture(port, False, CONSOLE_BAUD)
+            port.close()
+    print(f"{records} records, {gaps} after dropped data", file=sys.stderr)
+
+if __name__ == "__main__":
+    main()
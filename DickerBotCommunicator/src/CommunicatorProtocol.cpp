@@ -0,0 +1,68 @@
+/*
+    CommunicatorProtocol.cpp - Parsing of the messages the DickerBot's communicator receives from the controller and the socket.
+    Released into the public domain
+*/
+
+#include "CommunicatorProtocol.h"
+#include <stdio.h>
+#include <string.h>
+
+bool CommunicatorProtocol::ParseSensorData(const char* fields, SensorData &frame, int &channels) {
+    SensorData parsed = frame;
+    const char* cursor = fields;
+    int consumed = 0;
+    bool valid;
+    channels = 0;
+    if (memchr(cursor, '.', strcspn(cursor, ",")) != nullptr) {
+        // A controller older than version 3 sends every value, starting with a float
+        channels = (1 << NUM_SENSOR_CHANNELS) - 1;
+        valid = sscanf(cursor, "%f,%f,%f,%f,%f,%f,%f,%d,%d,%d,%d", &parsed.ax, &parsed.ay, &parsed.az, &parsed.gx, &parsed.gy, &parsed.gz, &parsed.t, &parsed.dL, &parsed.dF, &parsed.dR, &parsed.dB) == 11;
+    }
+    else {
+        valid = sscanf(cursor, "%d%n", &channels, &consumed) == 1;
+        cursor += consumed;
+        if (valid && (channels & (1 << SENSOR_CHANNEL_IMU))) {
+            valid = sscanf(cursor, ",%f,%f,%f,%f,%f,%f%n", &parsed.ax, &parsed.ay, &parsed.az, &parsed.gx, &parsed.gy, &parsed.gz, &consumed) == 6;
+            cursor += consumed;
+        }
+        if (valid && (channels & (1 << SENSOR_CHANNEL_TEMPERATURE))) {
+            valid = sscanf(cursor, ",%f%n", &parsed.t, &consumed) == 1;
+            cursor += consumed;
+        }
+        if (valid && (channels & (1 << SENSOR_CHANNEL_RANGING))) {
+            valid = sscanf(cursor, ",%d,%d,%d,%d%n", &parsed.dL, &parsed.dF, &parsed.dR, &parsed.dB, &consumed) == 4;
+            cursor += consumed;
+
+            // Filter status and confidence per sensor
+            unsigned int quality[8];
+            if (valid && sscanf(cursor, ",%u,%u,%u,%u,%u,%u,%u,%u%n", &quality[0], &quality[1], &quality[2], &quality[3], &quality[4], &quality[5], &quality[6], &quality[7], &consumed) == 8) {
+                for (int i = 0; i < 4; i++) {
+                    parsed.rangeStatus[i] = quality[i];
+                    parsed.rangeConfidence[i] = quality[4 + i];
+                }
+                cursor += consumed;
+            }
+        }
+    }
+    if (!valid) {
+        return false;
+    }
+
+    for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+        parsed.updates[i] += (channels >> i) & 1;
+    }
+    frame = parsed;
+    return true;
+}
+
+bool CommunicatorProtocol::ParseControllerHello(const char* fields, ControllerInfo &info) {
+    return sscanf(fields, "%d,%63[^,],%d", &info.version, info.capabilities, &info.max_sensor_hz) == 3;
+}
+
+bool CommunicatorProtocol::ParseControlData(const char* fields, char* robotId, ControlData &control) {
+    return sscanf(fields, "%17[^,],%d,%d,%d,%d", robotId, &control.left_wheel_speed, &control.left_wheel_direction, &control.right_wheel_speed, &control.right_wheel_direction) == 5;
+}
+
+bool CommunicatorProtocol::ParseClientHello(const char* fields, ClientHello &hello) {
+    return sscanf(fields, "%d,%63[^,],%d,%d", &hello.version, hello.encodings, &hello.sensor_hz, &hello.camera_hz) == 4;
+}
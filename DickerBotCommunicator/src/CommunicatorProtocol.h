@@ -0,0 +1,86 @@
+/*
+    CommunicatorProtocol.h - Parsing of the messages the DickerBot's communicator receives from the controller and the socket.
+    Released into the public domain
+
+    Each parser takes the fields of a message, after its prefix and without the ';' terminator.
+    Unlike the handlers that call it, free of Arduino dependencies so recorded traffic can be replayed
+    through it on Linux.
+*/
+#ifndef CommunicatorProtocol_h
+#define CommunicatorProtocol_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum SensorChannel { SENSOR_CHANNEL_IMU = 0, SENSOR_CHANNEL_TEMPERATURE, SENSOR_CHANNEL_RANGING, NUM_SENSOR_CHANNELS };  // Bit n of an SD channel mask
+
+struct SensorData {
+    float ax = 999, ay = 999, az = 999;  // Accelerometer
+    float gx = 999, gy = 999, gz = 999;  // Gyroscope
+    float t = 999;  // Temperature
+    int dL = 999, dF = 999, dR = 999, dB = 999;  // Distance sensors
+    uint8_t rangeStatus[4] = {0, 0, 0, 0};  // Controller RangeStatus per distance sensor, 0 = ok
+    uint8_t rangeConfidence[4] = {100, 100, 100, 100};  // 0-100 per distance sensor
+    uint32_t updates[NUM_SENSOR_CHANNELS] = {0, 0, 0};  // Times each channel was received, to tell which are new
+};
+
+struct ControlData {
+    int left_wheel_speed = 999;  // 0-255
+    int left_wheel_direction = 999;  // 0 = neutral, 1 = forward, 2 = backward
+    int right_wheel_speed = 999;  // 0-255
+    int right_wheel_direction = 999;  // 0 = neutral, 1 = forward, 2 = backward
+};
+
+struct ControllerInfo {
+    int version = 0;  // 0 until the controller answers the hello
+    char capabilities[64] = "";  // '|'-separated feature list
+    int max_sensor_hz = 0;
+};
+
+struct ClientHello {
+    int version = 0;
+    char encodings[64] = "";  // '|'-separated, preferred first
+    int sensor_hz = 0;  // 0 = as fast as the robot allows
+    int camera_hz = 0;
+};
+
+class CommunicatorProtocol {
+public:
+    static const size_t ROBOT_ID_LENGTH = 18;  // MAC address and terminator
+
+    /**
+     * @brief Parses sensor data from the controller, "channels,values..." or the full legacy frame of a controller older than version 3.
+     * @param fields The fields of the SD message.
+     * @param frame The latest values of every channel, updated with the channels in the message and their update counts.
+     * @param channels Output for the mask of the SensorChannels in the message.
+     * @return true if the message parsed. frame is left unchanged otherwise.
+     */
+    static bool ParseSensorData(const char* fields, SensorData &frame, int &channels);
+
+    /**
+     * @brief Parses the controller's hello, "version,capabilities,max_sensor_hz".
+     * @param fields The fields of the HL message.
+     * @param info Output for the controller's version and capabilities.
+     * @return true if all three values parsed.
+     */
+    static bool ParseControllerHello(const char* fields, ControllerInfo &info);
+
+    /**
+     * @brief Parses control data from the socket, "robot_id,left_wheel_speed,left_wheel_direction,right_wheel_speed,right_wheel_direction".
+     * @param fields The fields of the CD message.
+     * @param robotId Output for the robot id, at least ROBOT_ID_LENGTH bytes.
+     * @param control Output for the wheel state.
+     * @return true if all five values parsed.
+     */
+    static bool ParseControlData(const char* fields, char* robotId, ControlData &control);
+
+    /**
+     * @brief Parses a client's hello, "version,encodings,sensor_hz,camera_hz", following the robot id.
+     * @param fields The fields of the HL message after the robot id.
+     * @param hello Output for the client's version, encodings and requested rates.
+     * @return true if all four values parsed.
+     */
+    static bool ParseClientHello(const char* fields, ClientHello &hello);
+};
+
+#endif
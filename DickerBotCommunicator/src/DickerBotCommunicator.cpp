@@ -6,6 +6,9 @@
 
 #include "DickerBotCommunicator.h"
 
+const char* const DickerBotCommunicator::ENCODING_NAMES[] = {"txt", "bin", "rice"};
+const char* const DickerBotCommunicator::CAMERA_FORMAT = "gray96";
+
 DickerBotCommunicator::DickerBotCommunicator() {
     cameraBuffer =  nullptr;
 }
@@ -13,19 +16,37 @@ DickerBotCommunicator::DickerBotCommunicator() {
 void DickerBotCommunicator::Begin() {
     InitializeCommunicationToController();
     InitializeCommunicator();
+
+    // Associate with the access point while the camera starts up
+    bool connecting = BeginWifiConnection();
     InitializeCamera();
+    InitializeFlightRecorder();
     SequenceLEDIndicator(0);
+    if (connecting) {
+        FinishWifiConnection();
+    }
 }
 
 void DickerBotCommunicator::InitializeCommunicationToController() {
     communicatorSerial.begin(115200, SERIAL_8N1, COMMUNICATOR_RX, COMMUNICATOR_TX);
+    communicatorSerial.onReceiveError([this](hardwareSerial_error_t error) {
+        // Runs in the UART driver's event task
+        bool overrun = error == UART_BUFFER_FULL_ERROR || error == UART_FIFO_OVF_ERROR;
+        __atomic_fetch_add(overrun ? &uartLinkStats.overruns : &uartLinkStats.errors, 1, __ATOMIC_RELAXED);
+    });
 }
 
 void DickerBotCommunicator::InitializeCommunicator() {
     pinMode(COMMUNICATOR_STATUS_LED, OUTPUT);
     digitalWrite(COMMUNICATOR_STATUS_LED, LOW);
     pinMode(COMMUNICATOR_BUTTON, INPUT);
+    WiFi.persistent(false);  // Credentials live in preferences, skip the flash write on every begin
     WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
+    WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+        __atomic_fetch_add(&wifiDisconnects, 1, __ATOMIC_RELAXED);
+    }, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    robotId = WiFi.macAddress();
 }
 
 void DickerBotCommunicator::InitializeCamera() {
@@ -81,46 +102,248 @@ void DickerBotCommunicator::InitializeCamera() {
     }
 }
 
+void DickerBotCommunicator::InitializeFlightRecorder() {
+    if (!flightRecorder.Begin(FLIGHT_RECORDER_CAPACITY)) {
+        // ERROR: No PSRAM, recording disabled.
+        return;
+    }
+}
+
+void DickerBotCommunicator::StartPipeline() {
+    xTaskCreatePinnedToCore(&DickerBotCommunicator::UartTask, "uart", UART_TASK_STACK, this, UART_TASK_PRIORITY, &uartTask, UART_TASK_CORE);
+    xTaskCreatePinnedToCore(&DickerBotCommunicator::SocketTask, "socket", SOCKET_TASK_STACK, this, SOCKET_TASK_PRIORITY, &socketTask, SOCKET_TASK_CORE);
+}
+
+void DickerBotCommunicator::UartTask(void* parameter) {
+    DickerBotCommunicator* communicator = (DickerBotCommunicator*)parameter;
+    communicator->SendHelloToController();
+    for (;;) {
+        communicator->UpdateLEDIndicator();
+        communicator->ReceiveDataFromController();
+        communicator->SendQueuedDataToController();
+        vTaskDelay(1);
+    }
+}
+
+void DickerBotCommunicator::SocketTask(void* parameter) {
+    DickerBotCommunicator* communicator = (DickerBotCommunicator*)parameter;
+    unsigned long lastSensorTime = 0;
+    unsigned long lastCameraTime = 0;
+    unsigned long lastHealthTime = 0;
+    for (;;) {
+        communicator->HandleWebSocket();
+        communicator->SendControllerMessagesToSocket();
+        communicator->SaveQueuedConnectionData();
+
+        unsigned long currentTime = millis();
+        if (currentTime - lastSensorTime >= (unsigned long)communicator->sensorIntervalMs) {
+            lastSensorTime = currentTime;
+
+            if (communicator->GetConnectionStatus()) {
+                communicator->SendSensorDataToSocket();
+            }
+
+            // Connect when disconnected, freeze the flight recorder when connected
+            communicator->CheckCommunicatorButton();
+        }
+        if (currentTime - lastHealthTime >= LINK_HEALTH_PERIOD_MS) {
+            lastHealthTime = currentTime;
+
+            if (communicator->GetConnectionStatus()) {
+                communicator->SendLinkHealthToSocket();
+            }
+        }
+        if (currentTime - lastCameraTime >= (unsigned long)communicator->cameraIntervalMs) {
+            lastCameraTime = currentTime;
+
+            if (communicator->GetConnectionStatus()) {
+                communicator->SendCameraDataToSocket();
+            }
+        }
+        vTaskDelay(1);
+    }
+}
+
 void DickerBotCommunicator::ReceiveDataFromController() {
-    if (communicatorSerial.available()) {
-        String data = communicatorSerial.readStringUntil(';');
-        if (data.length() == 0) return;
+    uint32_t waiting = communicatorSerial.available();
+    uartLinkStats.high_water = max(uartLinkStats.high_water, waiting);
+    while (communicatorSerial.available()) {
+        char c = communicatorSerial.read();
+        uartLinkStats.rx_bytes++;
+        if (c != ';') {
+            if (uartReceiveBuffer.length < UartMessage::MAX_LENGTH - 1) {
+                uartReceiveBuffer.data[uartReceiveBuffer.length++] = c;
+            }
+            continue;
+        }
+
+        uartLinkStats.rx_frames++;
+        if (uartReceiveBuffer.length >= UartMessage::MAX_LENGTH - 1) {
+            // Truncated, drop it rather than pass on part of a message
+            __atomic_fetch_add(&uartLinkStats.overruns, 1, __ATOMIC_RELAXED);
+            uartReceiveBuffer.length = 0;
+            continue;
+        }
+        uartReceiveBuffer.data[uartReceiveBuffer.length] = '\0';
+        String data = String(uartReceiveBuffer.data);
+        uartReceiveBuffer.length = 0;
+        if (data.length() == 0) continue;
 
         if (data.startsWith("SD,")) {
             HandleSensorDataFromController(data);
         } 
+        else if (data.startsWith("QS,") || data.startsWith("TS,") || data.startsWith("SR,") || data.startsWith("RF,") || data.startsWith("LH,")) {
+            HandleTelemetryFromController(data);
+        }
+        else if (data.startsWith("HL,")) {
+            HandleHelloFromController(data);
+        }
         else if (data.startsWith("WD,")) {
             HandleConnectionDataFromController(data);
         }
+        else {
+            uartLinkStats.parse_failures++;
+        }
     }
 }
 
 void DickerBotCommunicator::HandleSensorDataFromController(String data) {
-    data = data.substring(3);
-    int numValues = sscanf(data.c_str(), "%f,%f,%f,%f,%f,%f,%f,%d,%d,%d,%d", &sensorBuffer.ax, &sensorBuffer.ay, &sensorBuffer.az, &sensorBuffer.gx, &sensorBuffer.gy, &sensorBuffer.gz, &sensorBuffer.t, &sensorBuffer.dL, &sensorBuffer.dF, &sensorBuffer.dR, &sensorBuffer.dB);
+    int channels;
+    if (CommunicatorProtocol::ParseSensorData(data.c_str() + 3, sensorState, channels)) {
+        const SensorData &frame = sensorState;
+        sensorFrames.Publish(frame);
+
+        FlightRecord record;
+        record.type = FLIGHT_RECORD_SENSOR;
+        record.values[0] = frame.ax;
+        record.values[1] = frame.ay;
+        record.values[2] = frame.az;
+        record.values[3] = frame.gx;
+        record.values[4] = frame.gy;
+        record.values[5] = frame.gz;
+        record.values[6] = frame.t;
+        record.ints[0] = frame.dL;
+        record.ints[1] = frame.dF;
+        record.ints[2] = frame.dR;
+        record.ints[3] = frame.dB;
+        flightRecorder.Record(record);
+    }
+    else {
+        uartLinkStats.parse_failures++;
+    }
+}
+
+void DickerBotCommunicator::HandleTelemetryFromController(String data) {
+    controllerMessages.Push(data.c_str(), data.length());
+}
+
+void DickerBotCommunicator::HandleHelloFromController(String data) {
+    ControllerInfo info;
+    if (CommunicatorProtocol::ParseControllerHello(data.c_str() + 3, info)) {
+        controllerInfo.Publish(info);
+        uartLinkStats.reconnects++;
+    }
+    else {
+        uartLinkStats.parse_failures++;
+    }
 }
 
 void DickerBotCommunicator::HandleConnectionDataFromController(String data) {
     data = data.substring(3);
-    char ssid[32], password[64], ip[16];
+    char ssid[32], password[64], ip[16], static_ip[16], gateway[16], subnet[16];
     int port;
-    int numValues = sscanf(data.c_str(), "%31[^,],%63[^,],%15[^,],%d", ssid, password, ip, &port);
-    if (numValues == 4) {
-        SaveWifiCredentials(ssid, password, ip, port);
+    int numValues = sscanf(data.c_str(), "%31[^,],%63[^,],%15[^,],%d,%15[^,],%15[^,],%15[^,]", ssid, password, ip, &port, static_ip, gateway, subnet);
+    if (numValues >= 4) {
+        connectionData.Push(data.c_str(), data.length());  // Saved by the socket task
+    }
+    else {
+        uartLinkStats.parse_failures++;
     }
 
-    String macAddress = WiFi.macAddress();
-    communicatorSerial.print("RD," + macAddress + ";");
+    controllerLink.print("RD," + robotId + ";");
     SequenceLEDIndicator(1);
 }
 
+void DickerBotCommunicator::SaveQueuedConnectionData() {
+    uint16_t length;
+    const char* data;
+    while ((data = connectionData.Peek(length)) != nullptr) {
+        char ssid[32], password[64], ip[16], static_ip[16], gateway[16], subnet[16];
+        int port;
+        int numValues = sscanf(data, "%31[^,],%63[^,],%15[^,],%d,%15[^,],%15[^,],%15[^,]", ssid, password, ip, &port, static_ip, gateway, subnet);
+        if (numValues >= 4) {
+            SaveWifiCredentials(ssid, password, ip, port);
+        }
+        if (numValues == 7) {
+            SaveStaticIP(static_ip, gateway, subnet);
+        }
+        connectionData.Release(length);
+    }
+}
+
 void DickerBotCommunicator::SendSensorDataToSocket() {
-    String data = "SD," + String(sensorBuffer.ax) + "," + String(sensorBuffer.ay) + "," + String(sensorBuffer.az) + "," +
+    if (!sensorFrames.ReadIfNewer(sensorBuffer, sensorFrameSequence)) {
+        return;
+    }
+
+    uint8_t channels = 0;
+    for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+        if (sensorBuffer.updates[i] != sentSensorUpdates[i]) {
+            sentSensorUpdates[i] = sensorBuffer.updates[i];
+            channels |= 1 << i;
+        }
+    }
+
+    if (streamEncoding != ENCODING_TEXT && streamVersion >= 3) {
+        // Frame: "SD,<robot id>," followed by the channel mask and the new channels' values, little-endian:
+        // 6 floats IMU, 1 float temperature, 4 int32 ranging followed by 4 uint8 status and 4 uint8 confidence
+        uint8_t frame[32 + 1 + 7 * sizeof(float) + 4 * sizeof(int32_t) + 8];
+        size_t length = snprintf((char*)frame, 32, "SD,%s,", robotId.c_str());
+        frame[length++] = channels;
+        if (channels & (1 << SENSOR_CHANNEL_IMU)) {
+            float imu[6] = {sensorBuffer.ax, sensorBuffer.ay, sensorBuffer.az, sensorBuffer.gx, sensorBuffer.gy, sensorBuffer.gz};
+            memcpy(frame + length, imu, sizeof(imu));
+            length += sizeof(imu);
+        }
+        if (channels & (1 << SENSOR_CHANNEL_TEMPERATURE)) {
+            memcpy(frame + length, &sensorBuffer.t, sizeof(float));
+            length += sizeof(float);
+        }
+        if (channels & (1 << SENSOR_CHANNEL_RANGING)) {
+            int32_t distance[4] = {sensorBuffer.dL, sensorBuffer.dF, sensorBuffer.dR, sensorBuffer.dB};
+            memcpy(frame + length, distance, sizeof(distance));
+            length += sizeof(distance);
+            memcpy(frame + length, sensorBuffer.rangeStatus, sizeof(sensorBuffer.rangeStatus));
+            length += sizeof(sensorBuffer.rangeStatus);
+            memcpy(frame + length, sensorBuffer.rangeConfidence, sizeof(sensorBuffer.rangeConfidence));
+            length += sizeof(sensorBuffer.rangeConfidence);
+        }
+        SendBinaryToSocket(frame, length);
+        return;
+    }
+
+    if (streamEncoding != ENCODING_TEXT) {
+        // Version 2 frame: "SD,<robot id>," followed by 7 floats and 4 int32, little-endian
+        uint8_t frame[32 + 7 * sizeof(float) + 4 * sizeof(int32_t)];
+        size_t length = snprintf((char*)frame, 32, "SD,%s,", robotId.c_str());
+        float imu[7] = {sensorBuffer.ax, sensorBuffer.ay, sensorBuffer.az, sensorBuffer.gx, sensorBuffer.gy, sensorBuffer.gz, sensorBuffer.t};
+        int32_t distance[4] = {sensorBuffer.dL, sensorBuffer.dF, sensorBuffer.dR, sensorBuffer.dB};
+        memcpy(frame + length, imu, sizeof(imu));
+        length += sizeof(imu);
+        memcpy(frame + length, distance, sizeof(distance));
+        length += sizeof(distance);
+        SendBinaryToSocket(frame, length);
+        return;
+    }
+
+    // The text frame always carries every channel, with the latest value of the slower ones
+
+    String data = "SD," + robotId + "," + String(sensorBuffer.ax) + "," + String(sensorBuffer.ay) + "," + String(sensorBuffer.az) + "," +
                   String(sensorBuffer.gx) + "," + String(sensorBuffer.gy) + "," + String(sensorBuffer.gz) + "," +
                   String(sensorBuffer.t) + "," + String(sensorBuffer.dL) + "," + String(sensorBuffer.dF) + "," +
                   String(sensorBuffer.dR) + "," + String(sensorBuffer.dB) + ";";
 
-    webSocket.sendTXT(data);
+    SendTextToSocket(data);
 }
 
 void DickerBotCommunicator::SendCameraDataToSocket() {
@@ -129,22 +352,173 @@ void DickerBotCommunicator::SendCameraDataToSocket() {
         return;
     }
 
+    if (streamEncoding == ENCODING_LOSSLESS) {
+        // Frame: "ID,<robot id>," followed by the GrayscaleCodec stream
+        String header = "ID," + robotId + ",";
+        cameraFrame.resize(header.length() + GrayscaleCodec::MaxEncodedSize(cameraBuffer->width, cameraBuffer->height));
+        memcpy(cameraFrame.data(), header.c_str(), header.length());
+        size_t encodedLength = GrayscaleCodec::Encode(cameraBuffer->buf, cameraBuffer->width, cameraBuffer->height,
+                                                      cameraFrame.data() + header.length(), cameraFrame.size() - header.length());
+        esp_camera_fb_return(cameraBuffer);
+        if (encodedLength == 0) {
+            return;
+        }
+        cameraFrame.resize(header.length() + encodedLength);
+
+        SendBinaryToSocket(cameraFrame.data(), cameraFrame.size());
+        SendBootTimingToSocket();
+        return;
+    }
+
+    if (streamEncoding == ENCODING_BINARY) {
+        // Frame: "ID,<robot id>," followed by the raw pixels
+        String header = "ID," + robotId + ",";
+        cameraFrame.resize(header.length() + cameraBuffer->len);
+        memcpy(cameraFrame.data(), header.c_str(), header.length());
+        memcpy(cameraFrame.data() + header.length(), cameraBuffer->buf, cameraBuffer->len);
+        esp_camera_fb_return(cameraBuffer);
+
+        SendBinaryToSocket(cameraFrame.data(), cameraFrame.size());
+        SendBootTimingToSocket();
+        return;
+    }
+
     String base64Image = base64::encode(cameraBuffer->buf, cameraBuffer->len);
     esp_camera_fb_return(cameraBuffer); 
 
-    String data = "ID," + base64Image + ";";
+    String data = "ID," + robotId + "," + base64Image + ";";
     
-    webSocket.sendTXT(data);
+    SendTextToSocket(data);
+    SendBootTimingToSocket();
+}
+
+void DickerBotCommunicator::SendHelloToController() {
+    controllerLink.printf("HL,%d;", PROTOCOL_VERSION);
+}
+
+void DickerBotCommunicator::SendHelloToSocket() {
+    ControllerInfo info;
+    uint32_t sequence = 0;
+    controllerInfo.ReadIfNewer(info, sequence);
+
+    String encodings = "";
+    for (int i = NUM_ENCODINGS - 1; i >= 0; i--) {
+        encodings += ENCODING_NAMES[i];
+        encodings += (i > 0) ? "|" : "";
+    }
+    String data = "HL," + robotId + "," + String(PROTOCOL_VERSION) + "," + encodings + "," + CAMERA_FORMAT + "," +
+                  String(MAX_SENSOR_RATE_HZ) + "," + String(MAX_CAMERA_RATE_HZ) + "," +
+                  String(info.version) + "," + String(info.version > 0 ? info.capabilities : "") + ";";
+    SendTextToSocket(data);
+}
+
+void DickerBotCommunicator::HandleHelloFromSocket(const char* fields) {
+    ClientHello hello;
+    if (!CommunicatorProtocol::ParseClientHello(fields, hello)) {
+        socketLinkStats.parse_failures++;
+        return;
+    }
+
+    streamVersion = min(hello.version, (int)PROTOCOL_VERSION);
+
+    // Pick the fastest encoding both sides support
+    streamEncoding = ENCODING_TEXT;
+    for (int i = NUM_ENCODINGS - 1; i > ENCODING_TEXT; i--) {
+        char* token = hello.encodings;
+        while (token != nullptr) {
+            size_t length = strcspn(token, "|");
+            if (length == strlen(ENCODING_NAMES[i]) && strncmp(token, ENCODING_NAMES[i], length) == 0) {
+                streamEncoding = i;
+                break;
+            }
+            token = token[length] == '|' ? token + length + 1 : nullptr;
+        }
+        if (streamEncoding != ENCODING_TEXT) {
+            break;
+        }
+    }
+    int sensor_hz = constrain(hello.sensor_hz > 0 ? hello.sensor_hz : MAX_SENSOR_RATE_HZ, 1, MAX_SENSOR_RATE_HZ);
+    int camera_hz = constrain(hello.camera_hz > 0 ? hello.camera_hz : MAX_CAMERA_RATE_HZ, 1, MAX_CAMERA_RATE_HZ);
+    sensorIntervalMs = 1000 / sensor_hz;
+    cameraIntervalMs = 1000 / camera_hz;
+
+    String data = "NG," + robotId + "," + String(streamVersion) + "," + ENCODING_NAMES[streamEncoding] + "," +
+                  CAMERA_FORMAT + "," + String(sensor_hz) + "," + String(camera_hz) + ";";
+    SendTextToSocket(data);
 }
 
 void DickerBotCommunicator::SendControlDataToController() {
-    communicatorSerial.printf("CD,%d,%d,%d,%d;", controlBuffer.left_wheel_speed, controlBuffer.left_wheel_direction, controlBuffer.right_wheel_speed, controlBuffer.right_wheel_direction);
+    char data[48];
+    snprintf(data, sizeof(data), "CD,%d,%d,%d,%d", controlBuffer.left_wheel_speed, controlBuffer.left_wheel_direction, controlBuffer.right_wheel_speed, controlBuffer.right_wheel_direction);
+    QueueMessageToController(data);
+}
+
+void DickerBotCommunicator::QueueMessageToController(const char* data) {
+    size_t length = strlen(data);
+    if (length >= UartMessage::MAX_LENGTH) {
+        return;  // The controller would drop it as overlong
+    }
+    controllerCommands.Push(data, length);
+}
+
+void DickerBotCommunicator::SendQueuedDataToController() {
+    uint16_t length;
+    const char* message;
+    while ((message = controllerCommands.Peek(length)) != nullptr) {
+        controllerLink.write((const uint8_t*)message, length);
+        controllerLink.write(';');
+        controllerCommands.Release(length);
+    }
+}
+
+void DickerBotCommunicator::SendControllerMessagesToSocket() {
+    uint16_t length;
+    const char* message;
+    while ((message = controllerMessages.Peek(length)) != nullptr) {
+        if (connected_to_socket && length >= 3) {
+            // Insert the robot id after the prefix: "QS,..." -> "QS,<robot id>,..."
+            String data = String(message).substring(0, 3) + robotId + "," + String(message + 3) + ";";
+            SendTextToSocket(data);
+        }
+        controllerMessages.Release(length);
+    }
+}
+
+void DickerBotCommunicator::SendMotionQueueDataToController(const char* data) {
+    char message[UartMessage::MAX_LENGTH];
+    int length = snprintf(message, sizeof(message), "MQ,%s", data);
+    if (length >= (int)sizeof(message)) {
+        return;
+    }
+    QueueMessageToController(message);
+}
+
+void DickerBotCommunicator::SendSensorRateDataToController(const char* data) {
+    char message[48];
+    int length = snprintf(message, sizeof(message), "SR,%s", data);
+    if (length >= (int)sizeof(message)) {
+        return;
+    }
+    QueueMessageToController(message);
+}
+
+void DickerBotCommunicator::SendRangeFilterDataToController(const char* data) {
+    char message[64];
+    int length = snprintf(message, sizeof(message), "RF,%s", data);
+    if (length >= (int)sizeof(message)) {
+        return;
+    }
+    QueueMessageToController(message);
 }
 
 bool DickerBotCommunicator::GetConnectionStatus() { 
     return connected_to_socket;
 }
 
+String DickerBotCommunicator::GetRobotId() {
+    return robotId;
+}
+
 void DickerBotCommunicator::CheckCommunicatorButton() {
     static unsigned long buttonPressStart = 0;
     static bool buttonPressed = false;
@@ -161,7 +535,12 @@ void DickerBotCommunicator::CheckCommunicatorButton() {
             unsigned long pressDuration = millis() - buttonPressStart;
 
             if (pressDuration < 1000) {
-                ConnectToSocket();
+                if (connected_to_socket) {
+                    TriggerFlightRecorder(FLIGHT_TRIGGER_BUTTON);
+                }
+                else {
+                    ConnectToSocket();
+                }
             } 
             else if (pressDuration > 3000) {
                 ClearWifiCredentials();
@@ -176,6 +555,19 @@ void DickerBotCommunicator::SaveWifiCredentials(const char* ssid, const char* pa
     preferences.putString("pass", password);
     preferences.putString("ip", ws_ip);
     preferences.putInt("port", ws_port);
+    // A new network invalidates the cached access point, lease and static IP
+    preferences.remove("cache");
+    preferences.remove("sip");
+    preferences.remove("sgw");
+    preferences.remove("smask");
+    preferences.end();
+}
+
+void DickerBotCommunicator::SaveStaticIP(const char* static_ip, const char* gateway, const char* subnet) {
+    preferences.begin("wifi_data", false);
+    preferences.putString("sip", static_ip);
+    preferences.putString("sgw", gateway);
+    preferences.putString("smask", subnet);
     preferences.end();
 }
 
@@ -203,7 +595,70 @@ void DickerBotCommunicator::ClearWifiCredentials() {
     }
 }
 
-void DickerBotCommunicator::ConnectToSocket() {
+void DickerBotCommunicator::SaveConnectionCache() {
+    ConnectionCache cache;
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.local_ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP();
+
+    // Only write flash when the access point or lease changed
+    ConnectionCache saved;
+    preferences.begin("wifi_data", false);
+    if (preferences.getBytes("cache", &saved, sizeof(saved)) != sizeof(saved) || memcmp(&saved, &cache, sizeof(cache)) != 0) {
+        preferences.putBytes("cache", &cache, sizeof(cache));
+    }
+    preferences.end();
+}
+
+bool DickerBotCommunicator::LoadConnectionCache(ConnectionCache &cache) {
+    preferences.begin("wifi_data", true);
+    bool found = preferences.getBytes("cache", &cache, sizeof(cache)) == sizeof(cache);
+    String static_ip = preferences.getString("sip", "");
+    String gateway = preferences.getString("sgw", "");
+    String subnet = preferences.getString("smask", "");
+    preferences.end();
+
+    IPAddress address;
+    if (static_ip.length() > 0 && address.fromString(static_ip)) {
+        cache.local_ip = address;
+        cache.gateway = address.fromString(gateway) ? (uint32_t)address : 0;
+        cache.subnet = address.fromString(subnet) ? (uint32_t)address : 0;
+        cache.dns = cache.gateway;
+    }
+    return found;
+}
+
+bool DickerBotCommunicator::BeginWifiConnection() {
+    String ssid, password, ws_ip;
+    int ws_port;
+
+    if (!LoadWifiCredentials(ssid, password, ws_ip, ws_port)) {
+        return false;
+    }
+
+    // Skip the scan and DHCP when the last access point and lease (or a static IP) are known
+    ConnectionCache cache;
+    wifiUsingCache = LoadConnectionCache(cache);
+    if (cache.local_ip != 0) {
+        WiFi.config(IPAddress(cache.local_ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+    }
+    else {
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    }
+    if (wifiUsingCache) {
+        WiFi.begin(ssid.c_str(), password.c_str(), cache.channel, cache.bssid);
+    }
+    else {
+        WiFi.begin(ssid.c_str(), password.c_str());
+    }
+    SequenceLEDIndicator(2);
+    return true;
+}
+
+void DickerBotCommunicator::FinishWifiConnection() {
     String ssid, password, ws_ip;
     int ws_port;
 
@@ -211,38 +666,154 @@ void DickerBotCommunicator::ConnectToSocket() {
         return;
     }
 
-    WiFi.begin(ssid.c_str(), password.c_str());
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-        delay(500);
-        SequenceLEDIndicator(2);
-        attempts++;
+    unsigned long start = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - start < (unsigned long)(wifiUsingCache ? WIFI_CACHED_TIMEOUT_MS : WIFI_TIMEOUT_MS)) {
+        delay(10);
+    }
+
+    if (WiFi.status() != WL_CONNECTED && wifiUsingCache) {
+        // The access point moved or the lease is stale, forget it and do a full scan and DHCP
+        preferences.begin("wifi_data", false);
+        preferences.remove("cache");
+        preferences.end();
+        WiFi.disconnect();
+        BeginWifiConnection();
+        FinishWifiConnection();
+        return;
     }
 
     if (WiFi.status() != WL_CONNECTED) {
+        RecordLinkEvent(FLIGHT_LINK_WIFI_FAILED);
         return;
     }
+    RecordLinkEvent(FLIGHT_LINK_WIFI_CONNECTED);
+    SaveConnectionCache();
+    if (bootTiming.wifi_ms == 0) {
+        bootTiming.wifi_ms = millis();
+        bootTiming.cached = wifiUsingCache;
+    }
 
     webSocket.begin(ws_ip.c_str(), ws_port, "/");
     webSocket.onEvent([this](WStype_t type, uint8_t *payload, size_t length) {
         this->OnWebSocketEvent(type, payload, length);
     });
     
-    webSocket.setReconnectInterval(3000);
+    webSocket.setReconnectInterval(SOCKET_RECONNECT_INTERVAL_MS);
     SequenceLEDIndicator(3);
 }
 
+void DickerBotCommunicator::ConnectToSocket() {
+    if (BeginWifiConnection()) {
+        FinishWifiConnection();
+    }
+}
+
+void DickerBotCommunicator::SendBootTimingToSocket() {
+    if (!bootTimingPending) {
+        return;
+    }
+    bootTimingPending = false;
+    if (bootTiming.first_frame_ms == 0) {
+        bootTiming.first_frame_ms = millis();
+    }
+
+    SendTextToSocket("BT," + robotId + "," + String(bootTiming.wifi_ms) + "," + String(bootTiming.socket_ms) + "," +
+                      String(bootTiming.first_frame_ms) + "," + String(bootTiming.reconnect_ms) + "," + String(bootTiming.cached ? 1 : 0) + ";");
+}
+
+bool DickerBotCommunicator::SendTextToSocket(const String &data) {
+    bool sent = webSocket.sendTXT(data.c_str(), data.length());
+    socketLinkStats.tx_bytes += sent ? data.length() : 0;
+    socketLinkStats.tx_frames += sent ? 1 : 0;
+    socketLinkStats.errors += sent ? 0 : 1;
+    return sent;
+}
+
+bool DickerBotCommunicator::SendBinaryToSocket(const uint8_t* data, size_t length) {
+    bool sent = webSocket.sendBIN(data, length);
+    socketLinkStats.tx_bytes += sent ? length : 0;
+    socketLinkStats.tx_frames += sent ? 1 : 0;
+    socketLinkStats.errors += sent ? 0 : 1;
+    return sent;
+}
+
+void DickerBotCommunicator::SendLinkHealthToSocket() {
+    // Fields per link: rx_bytes,rx_frames,tx_bytes,tx_frames,parse_failures,errors,overruns,high_water,reconnects
+    char data[224];
+    const LinkStats &uart = uartLinkStats;
+    snprintf(data, sizeof(data), "LH,%s,uart,%u,%u,%u,%u,%u,%u,%u,%u,%u;", robotId.c_str(), uart.rx_bytes, uart.rx_frames, uart.tx_bytes, uart.tx_frames,
+             uart.parse_failures, __atomic_load_n(&uart.errors, __ATOMIC_RELAXED),
+             __atomic_load_n(&uart.overruns, __ATOMIC_RELAXED) + controllerCommands.GetDropped(), uart.high_water, uart.reconnects);
+    SendTextToSocket(data);
+
+    // Round-trip percentiles over the last RTT_SAMPLES pongs
+    uint32_t sorted[RTT_SAMPLES];
+    memcpy(sorted, rttSamples, numRttSamples * sizeof(uint32_t));
+    std::sort(sorted, sorted + numRttSamples);
+    uint32_t p50 = numRttSamples > 0 ? sorted[numRttSamples * 50 / 100] : 0;
+    uint32_t p90 = numRttSamples > 0 ? sorted[numRttSamples * 90 / 100] : 0;
+    uint32_t p99 = numRttSamples > 0 ? sorted[numRttSamples * 99 / 100] : 0;
+
+    // The socket's high-water mark and overruns are for the controller messages waiting to be sent
+    const LinkStats &socket = socketLinkStats;
+    snprintf(data, sizeof(data), "LH,%s,socket,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%d;", robotId.c_str(), socket.rx_bytes, socket.rx_frames, socket.tx_bytes, socket.tx_frames,
+             socket.parse_failures, socket.errors, controllerMessages.GetDropped(), controllerMessages.GetHighWaterMark(), socket.reconnects,
+             p50, p90, p99, __atomic_load_n(&wifiDisconnects, __ATOMIC_RELAXED), WiFi.RSSI());
+    SendTextToSocket(data);
+
+    // A ping still unanswered after a whole period counts as lost
+    if (pingPending) {
+        socketLinkStats.errors++;
+    }
+    pingSentTime = micros();
+    pingPending = webSocket.sendPing();
+}
+
 void DickerBotCommunicator::OnWebSocketEvent(WStype_t type, uint8_t *payload, size_t length) {
+    if (type == WStype_TEXT || type == WStype_BIN) {
+        socketLinkStats.rx_bytes += length;
+        socketLinkStats.rx_frames++;
+    }
+
     switch (type) {
         case WStype_CONNECTED:
+            socketLinkStats.reconnects += (bootTiming.socket_ms != 0) ? 1 : 0;
             connected_to_socket = true;
+            RecordLinkEvent(FLIGHT_LINK_SOCKET_CONNECTED);
+            if (bootTiming.socket_ms == 0) {
+                bootTiming.socket_ms = millis();
+            }
+            else {
+                bootTiming.reconnect_ms = millis() - socketDisconnectTime;
+            }
+            bootTimingPending = true;
+
+            // Register with the host so commands for this robot are routed here
+            SendTextToSocket("RD," + robotId + ";");
+
+            // Every connection starts on the text protocol until a client says hello
+            streamEncoding = ENCODING_TEXT;
+            streamVersion = 1;
+            sensorIntervalMs = 1000 / MAX_SENSOR_RATE_HZ;
+            cameraIntervalMs = 1000 / MAX_CAMERA_RATE_HZ;
+            QueueMessageToController(("HL," + String(PROTOCOL_VERSION)).c_str());
+            SendSensorRateDataToController("-1,-1,-1");  // Report the current rates and filter settings
+            SendRangeFilterDataToController("-1,-1,-1,-1,-1");
+            SendHelloToSocket();
 
             SequenceLEDIndicator(3);
             
             break;
         
         case WStype_DISCONNECTED:
+            if (connected_to_socket) {
+                socketDisconnectTime = millis();
+            }
             connected_to_socket = false;
+            flightDumpActive = false;
+            pingPending = false;
+            RecordLinkEvent(FLIGHT_LINK_SOCKET_DISCONNECTED);
+            TriggerFlightRecorder(FLIGHT_TRIGGER_DISCONNECT);
 
             controlBuffer.left_wheel_speed = 0;
             controlBuffer.left_wheel_direction = 0;
@@ -256,15 +827,104 @@ void DickerBotCommunicator::OnWebSocketEvent(WStype_t type, uint8_t *payload, si
 
         case WStype_TEXT:
             if (payload[0] == 'C' && payload[1] == 'D' && payload[2] == ',') {
-                int left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction;
-                if (sscanf((char*)payload + 3, "%d,%d,%d,%d", &left_wheel_speed, &left_wheel_direction, &right_wheel_speed, &right_wheel_direction) == 4) {
-                    controlBuffer.left_wheel_speed = left_wheel_speed;
-                    controlBuffer.left_wheel_direction = left_wheel_direction;
-                    controlBuffer.right_wheel_speed = right_wheel_speed;
-                    controlBuffer.right_wheel_direction = right_wheel_direction;
+                char robot_id[CommunicatorProtocol::ROBOT_ID_LENGTH];
+                ControlData control;
+                if (!CommunicatorProtocol::ParseControlData((char*)payload + 3, robot_id, control)) {
+                    socketLinkStats.parse_failures++;
+                }
+                else if (robotId.equals(robot_id)) {
+                    controlBuffer = control;
                     SendControlDataToController();
+
+                    FlightRecord record;
+                    record.type = FLIGHT_RECORD_CONTROL;
+                    record.ints[0] = control.left_wheel_speed;
+                    record.ints[1] = control.left_wheel_direction;
+                    record.ints[2] = control.right_wheel_speed;
+                    record.ints[3] = control.right_wheel_direction;
+                    flightRecorder.Record(record);
                 } 
             }
+            else if (payload[0] == 'M' && payload[1] == 'Q' && payload[2] == ',') {
+                // Strip the robot id and pass the batch through untouched
+                char* batch = (char*)MatchRobotId((char*)payload + 3);
+                if (batch != nullptr && *batch == ',') {
+                    char* end = strchr(batch, ';');
+                    if (end != nullptr) {
+                        *end = '\0';
+                    }
+                    SendMotionQueueDataToController(batch + 1);
+
+                    FlightRecord record;
+                    record.type = FLIGHT_RECORD_MOTION;
+                    record.ints[0] = batch[1];
+                    record.ints[1] = 0;
+                    for (char* c = batch + 2; *c != '\0'; c++) {
+                        record.ints[1] += (*c == ',') ? 1 : 0;
+                    }
+                    record.ints[1] /= 5;
+                    flightRecorder.Record(record);
+                }
+            }
+            else if (payload[0] == 'S' && payload[1] == 'R' && payload[2] == ',') {
+                char* rates = (char*)MatchRobotId((char*)payload + 3);
+                if (rates != nullptr && *rates == ',') {
+                    char* end = strchr(rates, ';');
+                    if (end != nullptr) {
+                        *end = '\0';
+                    }
+                    SendSensorRateDataToController(rates + 1);
+                }
+            }
+            else if (payload[0] == 'R' && payload[1] == 'F' && payload[2] == ',') {
+                char* settings = (char*)MatchRobotId((char*)payload + 3);
+                if (settings != nullptr && *settings == ',') {
+                    char* end = strchr(settings, ';');
+                    if (end != nullptr) {
+                        *end = '\0';
+                    }
+                    SendRangeFilterDataToController(settings + 1);
+                }
+            }
+            else if (payload[0] == 'H' && payload[1] == 'L' && payload[2] == ',') {
+                const char* fields = MatchRobotId((char*)payload + 3);
+                if (fields != nullptr && *fields == ',') {
+                    HandleHelloFromSocket(fields + 1);
+                }
+            }
+            else if (payload[0] == 'F' && payload[2] == ',' && MatchRobotId((char*)payload + 3) != nullptr) {
+                if (payload[1] == 'D') {
+                    StartFlightRecorderDump();
+                }
+                else if (payload[1] == 'F') {
+                    TriggerFlightRecorder(FLIGHT_TRIGGER_REQUEST);
+                }
+                else if (payload[1] == 'A') {
+                    flightDumpActive = false;
+                    flightRecorder.Arm();
+                }
+            }
+            else {
+                socketLinkStats.parse_failures++;
+            }
+            break;
+
+        case WStype_BIN:
+            // Clients only send text frames
+            socketLinkStats.parse_failures++;
+            break;
+
+        case WStype_PONG:
+            if (pingPending) {
+                pingPending = false;
+                rttSamples[nextRttSample] = micros() - pingSentTime;
+                nextRttSample = (nextRttSample + 1) % RTT_SAMPLES;
+                numRttSamples = min(numRttSamples + 1, (int)RTT_SAMPLES);
+            }
+            break;
+
+        case WStype_ERROR:
+            socketLinkStats.errors++;
             break;
 
         default:
@@ -274,31 +934,98 @@ void DickerBotCommunicator::OnWebSocketEvent(WStype_t type, uint8_t *payload, si
 
 void DickerBotCommunicator::HandleWebSocket() {
     webSocket.loop();
+    ServiceFlightRecorderDump();
+}
+
+const char* DickerBotCommunicator::MatchRobotId(const char* fields) {
+    size_t length = robotId.length();
+    if (strncmp(fields, robotId.c_str(), length) != 0) {
+        return nullptr;
+    }
+    char next = fields[length];
+    return (next == ',' || next == ';' || next == '\0') ? fields + length : nullptr;
+}
+
+void DickerBotCommunicator::RecordLinkEvent(int event) {
+    FlightRecord record;
+    record.type = FLIGHT_RECORD_LINK;
+    record.ints[0] = event;
+    flightRecorder.Record(record);
+}
+
+void DickerBotCommunicator::TriggerFlightRecorder(int reason) {
+    // Keep recording for a while after a disconnect so the outage itself is captured
+    flightRecorder.Trigger(reason, reason == FLIGHT_TRIGGER_DISCONNECT ? FLIGHT_RECORDER_POST_TRIGGER : 0);
+}
+
+void DickerBotCommunicator::StartFlightRecorderDump() {
+    TriggerFlightRecorder(FLIGHT_TRIGGER_REQUEST);
+    flightDumpIndex = flightRecorder.GetOldestIndex();
+    flightDumpEnd = flightRecorder.GetHeadIndex();
+    flightDumpSent = 0;
+    flightDumpActive = true;
+}
+
+void DickerBotCommunicator::ServiceFlightRecorderDump() {
+    if (!flightDumpActive || !connected_to_socket) {
+        return;
+    }
+
+    // Frame: "FR,<robot id>," followed by raw FlightRecord structs
+    static uint8_t frame[32 + FLIGHT_RECORDER_DUMP_CHUNK * sizeof(FlightRecord)];
+    size_t headerLength = snprintf((char*)frame, 32, "FR,%s,", robotId.c_str());
+    size_t length = headerLength;
+    int numRecords = 0;
+    while (numRecords < FLIGHT_RECORDER_DUMP_CHUNK && flightDumpIndex < flightDumpEnd) {
+        FlightRecord record;
+        if (flightRecorder.Read(flightDumpIndex++, record)) {
+            memcpy(frame + length, &record, sizeof(FlightRecord));
+            length += sizeof(FlightRecord);
+            numRecords++;
+        }
+    }
+
+    if (numRecords > 0) {
+        SendBinaryToSocket(frame, length);
+        flightDumpSent += numRecords;
+    }
+    if (flightDumpIndex >= flightDumpEnd) {
+        SendTextToSocket("FE," + robotId + "," + String(flightDumpSent) + ";");
+        flightDumpActive = false;
+        flightRecorder.Arm();  // The frozen window has been delivered, so capture the next trigger's
+    }
 }
 
 void DickerBotCommunicator::SequenceLEDIndicator(int event) {
+    unsigned long duration;
     switch (event) {
         case 0: // Startup init complete (1.5-second flash)
-            digitalWrite(COMMUNICATOR_STATUS_LED, HIGH);
-            delay(1500);
-            digitalWrite(COMMUNICATOR_STATUS_LED, LOW);
+            duration = 1500;
             break;
         case 1: // Sync success (600ms flash)
-            digitalWrite(COMMUNICATOR_STATUS_LED, HIGH);
-            delay(600);
-            digitalWrite(COMMUNICATOR_STATUS_LED, LOW);
+            duration = 600;
             break;
         case 2: // Connecting to socket (300ms flash)
-            digitalWrite(COMMUNICATOR_STATUS_LED, HIGH);
-            delay(300);
-            digitalWrite(COMMUNICATOR_STATUS_LED, LOW);
+            duration = 300;
             break;
         case 3: // Socket connection success (1-second flash)
-            digitalWrite(COMMUNICATOR_STATUS_LED, HIGH);
-            delay(1000);
-            digitalWrite(COMMUNICATOR_STATUS_LED, LOW);
+            duration = 1000;
             break;
         default:
-            break;
+            return;
+    }
+    __atomic_store_n(&ledRequestMs, (uint32_t)duration, __ATOMIC_RELEASE);
+}
+
+void DickerBotCommunicator::UpdateLEDIndicator() {
+    uint32_t duration = __atomic_exchange_n(&ledRequestMs, 0, __ATOMIC_ACQUIRE);
+    if (duration != 0) {
+        digitalWrite(COMMUNICATOR_STATUS_LED, HIGH);
+        ledOffTime = millis() + duration;
+        ledOn = true;
+    }
+    if (ledOn && (long)(millis() - ledOffTime) >= 0) {
+        digitalWrite(COMMUNICATOR_STATUS_LED, LOW);
+        ledOn = false;
     }
 }
\ No newline at end of file
@@ -10,26 +10,37 @@
 #include <HardwareSerial.h>
 #include "esp_camera.h"
 #include <vector>
+#include <algorithm>
 #include <WiFi.h>
 #include "base64.h"
 #include <Preferences.h>
 #include <WiFiClientSecure.h>
 #include <WebSocketsClient.h>
+#include "FlightRecorder.h"
+#include "GrayscaleCodec.h"
+#include "SpscRing.h"
+#include "LinkStats.h"
+#include "CommunicatorProtocol.h"
 
-struct SensorData {
-    float ax = 999, ay = 999, az = 999;  // Accelerometer
-    float gx = 999, gy = 999, gz = 999;  // Gyroscope
-    float t = 999;  // Temperature
-    int dL = 999, dF = 999, dR = 999, dB = 999;  // Distance sensors
+struct ConnectionCache {
+    uint8_t bssid[6] = {0, 0, 0, 0, 0, 0};  // Access point last connected to
+    int32_t channel = 0;
+    uint32_t local_ip = 0, gateway = 0, subnet = 0, dns = 0;  // Last DHCP lease
 };
 
-struct ControlData {
-    int left_wheel_speed = 999;  // 0-255
-    int left_wheel_direction = 999;  // 0 = neutral, 1 = forward, 2 = backward
-    int right_wheel_speed = 999;  // 0-255
-    int right_wheel_direction = 999;  // 0 = neutral, 1 = forward, 2 = backward
+struct BootTiming {
+    uint32_t wifi_ms = 0;  // Power-on to Wi-Fi connected
+    uint32_t socket_ms = 0;  // Power-on to socket connected
+    uint32_t first_frame_ms = 0;  // Power-on to first camera frame sent
+    uint32_t reconnect_ms = 0;  // Socket outage to reconnected, 0 before the first outage
+    bool cached = false;  // Whether the cached access point and lease were used
 };
 
+struct UartMessage {
+    static const int MAX_LENGTH = 1280;  // Fits a full 64-segment motion queue batch, the controller's limit too
+    uint16_t length = 0;
+    char data[MAX_LENGTH];  // Message without its ';' terminator
+};
 
 class DickerBotCommunicator {
 private:
@@ -37,15 +48,55 @@ private:
     static const int COMMUNICATOR_TX = 14;
     static const int COMMUNICATOR_RX = 13;
     HardwareSerial communicatorSerial = HardwareSerial(1);
+    LinkStats uartLinkStats;  // Owned by the UART task, except line errors
+    CountingPrint controllerLink = CountingPrint(communicatorSerial, uartLinkStats);  // All writes to the controller go through here
 
     // ----- Communicator -----
     static const int COMMUNICATOR_STATUS_LED = 12;
     static const int COMMUNICATOR_BUTTON = 2;
-    Preferences preferences;
+    Preferences preferences;  // Socket task only, once the pipeline has started
+    uint32_t ledRequestMs = 0;  // Flash duration posted by any task, applied by the UART task
+    unsigned long ledOffTime = 0;  // Owned by the UART task
+    bool ledOn = false;
 
     // ----- Socket -----
     WebSocketsClient webSocket;
     bool connected_to_socket = false;
+    String robotId;  // MAC address, tags every frame sent to and accepted from the socket
+    static const int WIFI_CACHED_TIMEOUT_MS = 1500;  // Before falling back to a scan and DHCP
+    static const int WIFI_TIMEOUT_MS = 10000;
+    static const int SOCKET_RECONNECT_INTERVAL_MS = 500;
+    bool wifiUsingCache = false;
+    BootTiming bootTiming;
+    bool bootTimingPending = false;
+    unsigned long socketDisconnectTime = 0;
+
+    // ----- Link Health -----
+    static const int LINK_HEALTH_PERIOD_MS = 1000;  // Health report and RTT ping
+    static const int RTT_SAMPLES = 64;
+    LinkStats socketLinkStats;  // Owned by the socket task
+    uint32_t rttSamples[RTT_SAMPLES];  // Ping to pong in microseconds, oldest overwritten first
+    int numRttSamples = 0;
+    int nextRttSample = 0;
+    uint32_t pingSentTime = 0;
+    bool pingPending = false;
+    uint32_t wifiDisconnects = 0;  // Written by the Wi-Fi event task
+
+    // ----- Capabilities -----
+    // Version 1 is the original text-only protocol, spoken to any client that never says hello
+    // Version 3 sends only the sensor channels that changed
+    static const int PROTOCOL_VERSION = 3;
+    static const int MAX_SENSOR_RATE_HZ = 100;
+    static const int MAX_CAMERA_RATE_HZ = 30;
+    enum StreamEncoding { ENCODING_TEXT = 0, ENCODING_BINARY, ENCODING_LOSSLESS };
+    static const char* const ENCODING_NAMES[];  // Indexed by StreamEncoding, preferred last
+    static const int NUM_ENCODINGS = 3;
+    static const char* const CAMERA_FORMAT;
+    int streamEncoding = ENCODING_TEXT;
+    int streamVersion = 1;  // Protocol version agreed with the clients
+    int sensorIntervalMs = 1000 / MAX_SENSOR_RATE_HZ;
+    int cameraIntervalMs = 1000 / MAX_CAMERA_RATE_HZ;
+    SpscLatest<ControllerInfo> controllerInfo;  // UART -> socket, keep latest
 
     // ----- Camera -----
     framesize_t FRAME_SIZE_IMAGE = FRAMESIZE_96X96;
@@ -74,6 +125,65 @@ private:
     SensorData sensorBuffer;
     ControlData controlBuffer;
     camera_fb_t *cameraBuffer;
+    UartMessage uartReceiveBuffer;
+
+    std::vector<uint8_t> cameraFrame;  // Binary camera frame, reused between sends
+
+    // ----- Pipeline -----
+    // UART ingest/egress runs on the app core, Wi-Fi and socket work on the protocol core with the Wi-Fi stack
+    static const int UART_TASK_CORE = 1;
+    static const int UART_TASK_PRIORITY = 3;
+    static const int UART_TASK_STACK = 4096;
+    static const int SOCKET_TASK_CORE = 0;
+    static const int SOCKET_TASK_PRIORITY = 2;
+    static const int SOCKET_TASK_STACK = 8192;
+    TaskHandle_t uartTask = nullptr;
+    TaskHandle_t socketTask = nullptr;
+    SpscLatest<SensorData> sensorFrames;  // UART -> socket, keep latest
+    uint32_t sensorFrameSequence = 0;
+    SensorData sensorState;  // Latest value of every channel, owned by the UART task
+    uint32_t sentSensorUpdates[NUM_SENSOR_CHANNELS] = {0, 0, 0};  // Channel updates already sent, owned by the socket task
+    SpscMessageRing<2048> controllerMessages;  // UART -> socket telemetry, keep all. Messages are under ~130 bytes
+    SpscMessageRing<256> connectionData;  // UART -> socket, WD fields to save, so only the socket task touches preferences
+    SpscMessageRing<4096> controllerCommands;  // Socket -> UART, keep all. Holds three full MQ batches or hundreds of CD
+
+    /**
+     * @brief Entry point of the UART task.
+     * @param parameter The communicator instance.
+     * @return void
+     */
+    static void UartTask(void* parameter);
+
+    /**
+     * @brief Entry point of the socket task.
+     * @param parameter The communicator instance.
+     * @return void
+     */
+    static void SocketTask(void* parameter);
+
+    /**
+     * @brief Queues a message for the UART task to send to the controller module.
+     * @param data The message without its ';' terminator.
+     * @return void
+     */
+    void QueueMessageToController(const char* data);
+
+    // ----- Flight Recorder -----
+    static const uint32_t FLIGHT_RECORDER_CAPACITY = 16384;  // 1 MB of PSRAM
+    static const uint32_t FLIGHT_RECORDER_POST_TRIGGER = 2048;  // Records kept after a disconnect
+    static const int FLIGHT_RECORDER_DUMP_CHUNK = 32;  // Records per binary frame
+    FlightRecorder flightRecorder;
+    bool flightDumpActive = false;
+    uint32_t flightDumpIndex = 0;
+    uint32_t flightDumpEnd = 0;
+    uint32_t flightDumpSent = 0;
+
+    /**
+     * @brief Checks that a socket frame is addressed to this robot.
+     * @param fields The frame after its prefix, starting with the robot id.
+     * @return Pointer to the character following the robot id, nullptr if addressed to another robot.
+     */
+    const char* MatchRobotId(const char* fields);
 
 public:
     DickerBotCommunicator();
@@ -104,18 +214,57 @@ public:
     void InitializeCamera();
 
     /**
-     * @brief Receives data from the controller module.
+     * @brief Starts the flight recorder in PSRAM.
+     * @return void
+     */
+    void InitializeFlightRecorder();
+
+    /**
+     * @brief Starts the UART and socket tasks on separate cores.
+     * @return void
+     * @warning This function should be called once in setup() following Begin(). The Arduino loop is unused afterwards.
+     */
+    void StartPipeline();
+
+    /**
+     * @brief Receives all pending data from the controller module without blocking.
      * @return void
      */
     void ReceiveDataFromController();
 
     /**
-     * @brief Handles sensor data from the data receiver.
-     * @param data The data received from the controller module.
+     * @brief Sends all queued messages to the controller module.
+     * @return void
+     */
+    void SendQueuedDataToController();
+
+    /**
+     * @brief Sends all pending controller messages to the socket.
+     * @return void
+     */
+    void SendControllerMessagesToSocket();
+
+    /**
+     * @brief Merges the channels in a sensor frame from the controller into the latest sensor data.
+     * @param data The data received from the controller module, "SD,channels,..." or the full "SD,ax,...,dB".
      * @return void
      */
     void HandleSensorDataFromController(String data);
 
+    /**
+     * @brief Queues telemetry (motion queue status, task stats) from the controller module for the socket.
+     * @param data The data received from the controller module.
+     * @return void
+     */
+    void HandleTelemetryFromController(String data);
+
+    /**
+     * @brief Handles the hello reply from the controller module.
+     * @param data The data received from the controller module, "HL,version,capabilities,max_sensor_hz".
+     * @return void
+     */
+    void HandleHelloFromController(String data);
+
     /**
      * @brief Handles connection data from the data receiver.
      * @param data The data received from the controller module.
@@ -124,29 +273,81 @@ public:
     void HandleConnectionDataFromController(String data);
 
     /**
-     * @brief Sends sensor data to the socket as string.
+     * @brief Saves the connection data the UART task received from the controller.
+     * @return void
+     */
+    void SaveQueuedConnectionData();
+
+    /**
+     * @brief Sends the newest sensor data to the socket in the negotiated encoding, if any arrived since the last send.
      * @return void
      */
     void SendSensorDataToSocket();
 
     /**
-     * @brief Sends camera data to the socket as byte string.
+     * @brief Sends camera data to the socket in the negotiated encoding.
      * @return void
      */
     void SendCameraDataToSocket();
 
+    /**
+     * @brief Asks the controller module for its protocol version and capabilities.
+     * @return void
+     */
+    void SendHelloToController();
+
+    /**
+     * @brief Advertises protocol version, encodings, camera formats, maximum rates and controller capabilities to the socket.
+     * @return void
+     */
+    void SendHelloToSocket();
+
+    /**
+     * @brief Negotiates encoding and rates with a client hello and announces the result.
+     * @param fields The hello after the robot id, "version,encodings,sensor_hz,camera_hz".
+     * @return void
+     */
+    void HandleHelloFromSocket(const char* fields);
+
     /**
      * @brief Sends control data to the control module as string.
      * @return void
      */
     void SendControlDataToController();
 
+    /**
+     * @brief Sends a motion queue batch to the control module.
+     * @param data The batch without robot id, "mode,duration,lspeed,ldir,rspeed,rdir,...".
+     * @return void
+     */
+    void SendMotionQueueDataToController(const char* data);
+
+    /**
+     * @brief Sends per-channel sampling rates to the control module.
+     * @param data The rates without robot id, "imu_hz,temperature_hz,ranging_hz".
+     * @return void
+     */
+    void SendSensorRateDataToController(const char* data);
+
+    /**
+     * @brief Sends distance filter settings to the control module.
+     * @param data The settings without robot id, "sensor,window,max_rate_cm_s,min_cm,max_cm".
+     * @return void
+     */
+    void SendRangeFilterDataToController(const char* data);
+
     /**
      * @brief Gets the connection status to the socket.
      * @return true if connected, false otherwise.
      */
     bool GetConnectionStatus();
 
+    /**
+     * @brief Gets the robot identifier used to tag socket frames.
+     * @return The MAC address of the communicator.
+     */
+    String GetRobotId();
+
     /**
      * @brief Checks and handles multi purpose button press.
      * @return void
@@ -173,18 +374,79 @@ public:
      */
     bool LoadWifiCredentials(String &ssid, String &password, String &ws_ip, int &ws_port);
 
+    /**
+     * @brief Saves a static IP configuration to memory, used instead of DHCP.
+     * @param static_ip The IP address of the communicator.
+     * @param gateway The IP address of the gateway.
+     * @param subnet The subnet mask.
+     * @return void
+     */
+    void SaveStaticIP(const char* static_ip, const char* gateway, const char* subnet);
+
     /**
      * @brief Clears the wifi credentials from memory.
      * @return void
      */
     void ClearWifiCredentials();
 
+    /**
+     * @brief Saves the access point and DHCP lease of the current connection to memory, if they changed.
+     * @return void
+     */
+    void SaveConnectionCache();
+
+    /**
+     * @brief Loads the access point and IP configuration to reuse from memory.
+     * @param cache The cache to load into. A static IP, if saved, replaces the cached lease.
+     * @return true if a cached access point is available, false otherwise.
+     */
+    bool LoadConnectionCache(ConnectionCache &cache);
+
+    /**
+     * @brief Starts connecting to wifi without waiting, using the cached access point and IP when available.
+     * @return true if a connection was started, false if no credentials are saved.
+     */
+    bool BeginWifiConnection();
+
+    /**
+     * @brief Waits for the wifi connection started by BeginWifiConnection() and starts the socket.
+     * @return void
+     */
+    void FinishWifiConnection();
+
     /**
      * @brief Attempts to connect to the socket.
      * @return void
      */
     void ConnectToSocket();
 
+    /**
+     * @brief Sends the power-on and reconnect timings to the socket once streaming has started.
+     * @return void
+     */
+    void SendBootTimingToSocket();
+
+    /**
+     * @brief Sends a text frame to the socket, counting it in the link health.
+     * @param data The frame.
+     * @return true if the frame was sent, false otherwise.
+     */
+    bool SendTextToSocket(const String &data);
+
+    /**
+     * @brief Sends a binary frame to the socket, counting it in the link health.
+     * @param data The frame.
+     * @param length The length of the frame in bytes.
+     * @return true if the frame was sent, false otherwise.
+     */
+    bool SendBinaryToSocket(const uint8_t* data, size_t length);
+
+    /**
+     * @brief Sends the UART and socket link counters to the socket and pings the host to measure round-trip time.
+     * @return void
+     */
+    void SendLinkHealthToSocket();
+
     /**
      * @brief Handles events from the websocket.
      * @param type The type of event.
@@ -201,11 +463,44 @@ public:
     void HandleWebSocket();
 
     /**
-     * @brief Sequences the LED indicator for a given event.
+     * @brief Records a link event in the flight recorder.
+     * @param event The FlightLinkEvent to record.
+     * @return void
+     */
+    void RecordLinkEvent(int event);
+
+    /**
+     * @brief Freezes the flight recorder, keeping a post-trigger window for disconnects.
+     * @param reason The FlightTriggerReason.
+     * @return void
+     */
+    void TriggerFlightRecorder(int reason);
+
+    /**
+     * @brief Starts dumping the frozen flight recording to the socket.
+     * @return void
+     */
+    void StartFlightRecorderDump();
+
+    /**
+     * @brief Sends the next chunk of a running flight recording dump.
+     * @return void
+     */
+    void ServiceFlightRecorderDump();
+
+    /**
+     * @brief Sequences the LED indicator for a given event without blocking. Safe to call from any task,
+     * the UART task applies the request.
      * @param event The event number to sequence the LED for.
      * @return void
      */
     void SequenceLEDIndicator(int event);
+
+    /**
+     * @brief Starts a requested LED sequence and turns the LED off once it has elapsed. UART task only.
+     * @return void
+     */
+    void UpdateLEDIndicator();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+/*
+    FlightRecorder.cpp - Lock-free history recorder for the DickerBot's communicator.
+    Released into the public domain
+*/
+
+#include "FlightRecorder.h"
+
+bool FlightRecorder::Begin(uint32_t numRecords) {
+    if (!psramFound()) {
+        return false;
+    }
+
+    records = (FlightRecord*)ps_malloc(numRecords * sizeof(FlightRecord));
+    if (records == nullptr) {
+        return false;
+    }
+    memset((void*)records, 0, numRecords * sizeof(FlightRecord));
+    capacity = numRecords;
+    return true;
+}
+
+void FlightRecorder::Record(const FlightRecord &record) {
+    if (records == nullptr || __atomic_load_n(&frozen, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    // Reserve an index, unless the freeze point has been reached
+    uint32_t index = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        if (index >= __atomic_load_n(&freezeAt, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&frozen, true, __ATOMIC_RELEASE);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &index, index + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    FlightRecord &slot = records[index % capacity];
+    __atomic_store_n(&slot.sequence, 0, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);  // Invalidate the slot before overwriting it
+    slot.type = record.type;
+    slot.timestamp_us = esp_timer_get_time();
+    memcpy(slot.values, record.values, sizeof(slot.values));
+    memcpy(slot.ints, record.ints, sizeof(slot.ints));
+    __atomic_store_n(&slot.sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+void FlightRecorder::Trigger(int32_t reason, uint32_t postTriggerRecords) {
+    if (IsFrozen()) {
+        return;
+    }
+
+    FlightRecord record;
+    record.type = FLIGHT_RECORD_TRIGGER;
+    record.ints[0] = reason;
+    Record(record);
+
+    uint32_t freezeIndex = __atomic_load_n(&head, __ATOMIC_RELAXED) + postTriggerRecords;
+    __atomic_store_n(&freezeAt, freezeIndex, __ATOMIC_RELAXED);
+    if (postTriggerRecords == 0) {
+        __atomic_store_n(&frozen, true, __ATOMIC_RELEASE);
+    }
+}
+
+void FlightRecorder::Arm() {
+    __atomic_store_n(&freezeAt, UINT32_MAX, __ATOMIC_RELAXED);
+    __atomic_store_n(&frozen, false, __ATOMIC_RELEASE);
+}
+
+bool FlightRecorder::IsFrozen() {
+    return __atomic_load_n(&frozen, __ATOMIC_ACQUIRE);
+}
+
+uint32_t FlightRecorder::GetOldestIndex() {
+    uint32_t newest = GetHeadIndex();
+    return newest > capacity ? newest - capacity : 0;
+}
+
+uint32_t FlightRecorder::GetHeadIndex() {
+    return __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+bool FlightRecorder::Read(uint32_t index, FlightRecord &record) {
+    if (records == nullptr) {
+        return false;
+    }
+
+    FlightRecord &slot = records[index % capacity];
+    uint32_t before = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+    memcpy(&record, &slot, sizeof(FlightRecord));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);  // Finish the copy before checking it was not overwritten
+    uint32_t after = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+    return before == index + 1 && after == before;
+}
@@ -0,0 +1,107 @@
+/*
+    FlightRecorder.h - Lock-free history recorder for the DickerBot's communicator.
+    Released into the public domain
+*/
+#ifndef FlightRecorder_h
+#define FlightRecorder_h
+
+#include <Arduino.h>
+
+enum FlightRecordType : uint8_t {
+    FLIGHT_RECORD_SENSOR = 1,  // values = ax,ay,az,gx,gy,gz,t; ints = dL,dF,dR,dB
+    FLIGHT_RECORD_CONTROL = 2,  // ints = left speed, left direction, right speed, right direction
+    FLIGHT_RECORD_MOTION = 3,  // ints = mode, number of segments
+    FLIGHT_RECORD_LINK = 4,  // ints[0] = FlightLinkEvent
+    FLIGHT_RECORD_TRIGGER = 5  // ints[0] = FlightTriggerReason
+};
+
+enum FlightLinkEvent : int32_t {
+    FLIGHT_LINK_WIFI_CONNECTED = 1,
+    FLIGHT_LINK_WIFI_FAILED = 2,
+    FLIGHT_LINK_SOCKET_CONNECTED = 3,
+    FLIGHT_LINK_SOCKET_DISCONNECTED = 4
+};
+
+enum FlightTriggerReason : int32_t {
+    FLIGHT_TRIGGER_BUTTON = 1,
+    FLIGHT_TRIGGER_DISCONNECT = 2,
+    FLIGHT_TRIGGER_REQUEST = 3,
+    FLIGHT_TRIGGER_REFLEX_STOP = 4
+};
+
+// 64 bytes, sent as-is (little-endian) when the recording is dumped
+struct FlightRecord {
+    uint32_t sequence = 0;  // Write index + 1, 0 while the slot is being written
+    uint8_t type = 0;
+    uint8_t reserved[3] = {0, 0, 0};
+    uint64_t timestamp_us = 0;
+    float values[7] = {0, 0, 0, 0, 0, 0, 0};
+    int32_t ints[4] = {0, 0, 0, 0};
+    uint32_t padding = 0;
+};
+
+class FlightRecorder {
+private:
+    FlightRecord* records = nullptr;
+    uint32_t capacity = 0;
+    uint32_t head = 0;  // Next write index, reserved atomically by producers
+    uint32_t freezeAt = UINT32_MAX;  // Write index at which recording stops
+    bool frozen = false;
+
+public:
+    /**
+     * @brief Allocates the ring buffer in PSRAM.
+     * @param numRecords The number of records the ring buffer holds.
+     * @return true if the buffer was allocated, false otherwise.
+     */
+    bool Begin(uint32_t numRecords);
+
+    /**
+     * @brief Records an entry, stamping its sequence and time, unless recording has frozen. Safe to call from any task.
+     * @param record The record to store. Only type, values and ints are used.
+     * @return void
+     */
+    void Record(const FlightRecord &record);
+
+    /**
+     * @brief Freezes the recording after a number of further records.
+     * @param reason The FlightTriggerReason, stored as a trigger record.
+     * @param postTriggerRecords The number of records kept after the trigger, 0 to freeze immediately.
+     * @return void
+     */
+    void Trigger(int32_t reason, uint32_t postTriggerRecords);
+
+    /**
+     * @brief Resumes recording after a freeze, keeping the existing history.
+     * @return void
+     */
+    void Arm();
+
+    /**
+     * @brief Gets whether recording is frozen.
+     * @return true if frozen, false otherwise.
+     */
+    bool IsFrozen();
+
+    /**
+     * @brief Gets the index of the oldest record still held.
+     * @return The oldest record index.
+     */
+    uint32_t GetOldestIndex();
+
+    /**
+     * @brief Gets the index one past the newest record.
+     * @return The next write index.
+     */
+    uint32_t GetHeadIndex();
+
+    /**
+     * @brief Copies a record out of the ring buffer.
+     * @param index The record index, between GetOldestIndex() and GetHeadIndex().
+     * @param record The record to copy into.
+     * @return true if the record is intact, false if it was overwritten or is being written.
+     */
+    bool Read(uint32_t index, FlightRecord &record);
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+    GrayscaleCodec.cpp - Lossless compression of 8-bit grayscale frames for the DickerBot's communicator.
+    Released into the public domain
+*/
+
+#include "GrayscaleCodec.h"
+
+static const int ESCAPE_LENGTH = 16;  // Unary prefixes this long are followed by the raw residual
+static const int MAX_K = 7;
+static const uint32_t ADAPT_RESET = 32;  // Halve the running statistics this often to track local detail
+
+static inline uint8_t PredictPixel(const uint8_t* pixels, int x, int y, int width) {
+    if (y == 0) {
+        return x == 0 ? 128 : pixels[x - 1];
+    }
+    const uint8_t* row = pixels + y * width;
+    if (x == 0) {
+        return row[-width];
+    }
+    int left = row[x - 1];
+    int up = row[x - width];
+    int upLeft = row[x - width - 1];
+    int low = left < up ? left : up;
+    int high = left < up ? up : left;
+    if (upLeft >= high) {
+        return low;
+    }
+    if (upLeft <= low) {
+        return high;
+    }
+    return left + up - upLeft;
+}
+
+static inline int RiceParameter(uint32_t sum, uint32_t count) {
+    int k = 0;
+    while (k < MAX_K && (count << k) < sum) {
+        k++;
+    }
+    return k;
+}
+
+size_t GrayscaleCodec::MaxEncodedSize(uint16_t width, uint16_t height) {
+    return HEADER_SIZE + ((size_t)width * height * (ESCAPE_LENGTH + 8) + 7) / 8;
+}
+
+size_t GrayscaleCodec::Encode(const uint8_t* pixels, uint16_t width, uint16_t height, uint8_t* out, size_t capacity) {
+    if (capacity < HEADER_SIZE) {
+        return 0;
+    }
+    out[0] = width & 0xFF;
+    out[1] = width >> 8;
+    out[2] = height & 0xFF;
+    out[3] = height >> 8;
+
+    size_t length = HEADER_SIZE;
+    uint32_t accumulator = 0;  // Pending bits, right-aligned
+    int pending = 0;
+    uint32_t sum = 4, count = 1;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int residual = (int8_t)(pixels[y * width + x] - PredictPixel(pixels, x, y, width));
+            uint32_t value = residual >= 0 ? 2 * residual : -2 * residual - 1;
+            int k = RiceParameter(sum, count);
+            uint32_t quotient = value >> k;
+
+            uint32_t code;
+            int codeLength;
+            if (quotient < ESCAPE_LENGTH) {
+                code = (((1u << quotient) - 1) << (k + 1)) | (value & ((1u << k) - 1));
+                codeLength = quotient + 1 + k;
+            }
+            else {
+                code = (0xFFFFu << 8) | value;
+                codeLength = ESCAPE_LENGTH + 8;
+            }
+
+            accumulator = (accumulator << codeLength) | code;
+            pending += codeLength;
+            while (pending >= 8) {
+                if (length >= capacity) {
+                    return 0;
+                }
+                pending -= 8;
+                out[length++] = (uint8_t)(accumulator >> pending);
+            }
+
+            sum += value;
+            if (++count == ADAPT_RESET) {
+                sum >>= 1;
+                count >>= 1;
+            }
+        }
+    }
+
+    if (pending > 0) {
+        if (length >= capacity) {
+            return 0;
+        }
+        out[length++] = (uint8_t)(accumulator << (8 - pending));
+    }
+    return length;
+}
+
+bool GrayscaleCodec::Decode(const uint8_t* data, size_t length, uint8_t* pixels, size_t capacity, uint16_t &width, uint16_t &height) {
+    if (length < HEADER_SIZE) {
+        return false;
+    }
+    width = data[0] | (data[1] << 8);
+    height = data[2] | (data[3] << 8);
+    if ((size_t)width * height > capacity) {
+        return false;
+    }
+
+    size_t bitPosition = HEADER_SIZE * 8;
+    size_t bitLength = length * 8;
+    uint32_t sum = 4, count = 1;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int k = RiceParameter(sum, count);
+
+            int quotient = 0;
+            while (quotient < ESCAPE_LENGTH) {
+                if (bitPosition >= bitLength) {
+                    return false;
+                }
+                int bit = (data[bitPosition >> 3] >> (7 - (bitPosition & 7))) & 1;
+                bitPosition++;
+                if (bit == 0) {
+                    break;
+                }
+                quotient++;
+            }
+
+            int bitsToRead = quotient < ESCAPE_LENGTH ? k : 8;
+            if (bitPosition + bitsToRead > bitLength) {
+                return false;
+            }
+            uint32_t low = 0;
+            for (int i = 0; i < bitsToRead; i++) {
+                low = (low << 1) | ((data[bitPosition >> 3] >> (7 - (bitPosition & 7))) & 1);
+                bitPosition++;
+            }
+            uint32_t value = quotient < ESCAPE_LENGTH ? ((uint32_t)quotient << k) | low : low;
+
+            int residual = (value & 1) ? -(int)((value + 1) >> 1) : (int)(value >> 1);
+            pixels[y * width + x] = (uint8_t)(PredictPixel(pixels, x, y, width) + residual);
+
+            sum += value;
+            if (++count == ADAPT_RESET) {
+                sum >>= 1;
+                count >>= 1;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+/*
+    GrayscaleCodec.h - Lossless compression of 8-bit grayscale frames for the DickerBot's communicator.
+    Released into the public domain
+
+    Each pixel is predicted from its left, upper and upper-left neighbours (median edge
+    detector), and the residual is written with an adaptive Rice code. Free of Arduino
+    dependencies so it can be built and benchmarked on Linux.
+
+    Stream layout: uint16 width, uint16 height (little-endian), then the residual bits, MSB first.
+*/
+#ifndef GrayscaleCodec_h
+#define GrayscaleCodec_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+class GrayscaleCodec {
+public:
+    static const size_t HEADER_SIZE = 4;
+
+    /**
+     * @brief Gets the largest possible encoded size of a frame.
+     * @param width The frame width in pixels.
+     * @param height The frame height in pixels.
+     * @return The worst-case encoded size in bytes.
+     */
+    static size_t MaxEncodedSize(uint16_t width, uint16_t height);
+
+    /**
+     * @brief Compresses a frame.
+     * @param pixels The frame, row by row, one byte per pixel.
+     * @param width The frame width in pixels.
+     * @param height The frame height in pixels.
+     * @param out The buffer to write the encoded frame to.
+     * @param capacity The size of out in bytes.
+     * @return The encoded size in bytes, 0 if out was too small.
+     */
+    static size_t Encode(const uint8_t* pixels, uint16_t width, uint16_t height, uint8_t* out, size_t capacity);
+
+    /**
+     * @brief Decompresses a frame.
+     * @param data The encoded frame.
+     * @param length The size of data in bytes.
+     * @param pixels The buffer to write the frame to.
+     * @param capacity The size of pixels in bytes.
+     * @param width Output for the frame width in pixels.
+     * @param height Output for the frame height in pixels.
+     * @return true if the frame decoded, false if data was malformed or pixels too small.
+     */
+    static bool Decode(const uint8_t* data, size_t length, uint8_t* pixels, size_t capacity, uint16_t &width, uint16_t &height);
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+    SpscRing.h - Lock-free single-producer/single-consumer handoff between the DickerBot's communicator tasks.
+    Released into the public domain
+*/
+#ifndef SpscRing_h
+#define SpscRing_h
+
+#include <Arduino.h>
+
+/*
+    Keep-all policy for text messages of any length: a bounded FIFO of bytes, each message stored
+    contiguously behind its length and sequence number and followed by a null, so it costs only its
+    own size. A message that does not fit is rejected and counted as dropped; sequence numbers count
+    every message offered, so the consumer sees a gap for each one dropped. The consumer reads
+    messages in place.
+    Bytes must be a power of two.
+*/
+template <uint32_t Bytes>
+class SpscMessageRing {
+private:
+    static_assert((Bytes & (Bytes - 1)) == 0, "SpscMessageRing size must be a power of two");
+    static const uint32_t LENGTH_SIZE = sizeof(uint16_t);
+    static const uint32_t HEADER = LENGTH_SIZE + sizeof(uint32_t);  // Length, then sequence number
+    static const uint16_t WRAP = UINT16_MAX;  // Length marking unused space at the end of the buffer
+
+    char buffer[Bytes];
+    uint32_t head = 0;  // Bytes written, written by the producer only
+    uint32_t tail = 0;  // Bytes released, written by the consumer only
+    uint32_t offered = 0;  // Messages pushed or dropped, written by the producer only
+    uint32_t dropped = 0;  // Written by the producer only
+    uint32_t highWaterMark = 0;  // Written by the producer only
+
+public:
+    /**
+     * @brief Appends a message, numbering it with the count of messages offered so far. Producer side only.
+     * @param data The message.
+     * @param length The length of the message.
+     * @return true if appended, false if there was no room and the message was dropped.
+     */
+    bool Push(const char* data, uint16_t length) {
+        uint32_t currentHead = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        uint32_t used = currentHead - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        uint32_t offset = currentHead & (Bytes - 1);
+        uint32_t size = HEADER + length + 1;
+        uint32_t skip = Bytes - offset < size ? Bytes - offset : 0;  // Messages never wrap around the end
+        uint32_t sequence = ++offered;
+        if (length == WRAP || used + skip + size > Bytes) {
+            __atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        if (skip > 0) {
+            if (skip >= LENGTH_SIZE) {
+                uint16_t marker = WRAP;
+                memcpy(buffer + offset, &marker, LENGTH_SIZE);
+            }
+            offset = 0;
+        }
+        memcpy(buffer + offset, &length, LENGTH_SIZE);
+        memcpy(buffer + offset + LENGTH_SIZE, &sequence, sizeof(sequence));
+        memcpy(buffer + offset + HEADER, data, length);
+        buffer[offset + HEADER + length] = '\0';
+        if (used + skip + size > highWaterMark) {
+            __atomic_store_n(&highWaterMark, used + skip + size, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&head, currentHead + skip + size, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief Gets the oldest message without removing it. Consumer side only.
+     * @param length Output for the length of the message.
+     * @param sequence Optional output for the message's sequence number, starting at 1. A gap means messages were dropped.
+     * @return The null-terminated message, valid until Release(), or nullptr if the ring is empty.
+     */
+    const char* Peek(uint16_t &length, uint32_t* sequence = nullptr) {
+        uint32_t currentTail = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        if (currentTail == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+            return nullptr;
+        }
+        uint32_t offset = currentTail & (Bytes - 1);
+        uint16_t stored = WRAP;
+        if (Bytes - offset >= LENGTH_SIZE) {
+            memcpy(&stored, buffer + offset, LENGTH_SIZE);
+        }
+        if (stored == WRAP) {
+            // The producer skipped the end of the buffer, the message is at the start
+            __atomic_store_n(&tail, currentTail + Bytes - offset, __ATOMIC_RELEASE);
+            offset = 0;
+            memcpy(&stored, buffer, LENGTH_SIZE);
+        }
+        length = stored;
+        if (sequence != nullptr) {
+            memcpy(sequence, buffer + offset + LENGTH_SIZE, sizeof(*sequence));
+        }
+        return buffer + offset + HEADER;
+    }
+
+    /**
+     * @brief Removes the message returned by Peek(). Consumer side only.
+     * @param length The length Peek() returned.
+     * @return void
+     */
+    void Release(uint16_t length) {
+        __atomic_store_n(&tail, __atomic_load_n(&tail, __ATOMIC_RELAXED) + HEADER + length + 1, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Gets the number of messages rejected because the ring was full.
+     * @return The dropped message count.
+     */
+    uint32_t GetDropped() {
+        return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * @brief Gets the most bytes held at once.
+     * @return The high-water mark in bytes.
+     */
+    uint32_t GetHighWaterMark() {
+        return __atomic_load_n(&highWaterMark, __ATOMIC_RELAXED);
+    }
+};
+
+/*
+    Keep-latest policy: a single-slot sequence lock. The producer never blocks and always
+    overwrites; the consumer gets the newest complete item and can tell from the sequence
+    number how many it skipped.
+*/
+template <typename T>
+class SpscLatest {
+private:
+    T item;
+    uint32_t sequence = 0;  // Odd while the producer is writing, item count is sequence / 2
+
+public:
+    /**
+     * @brief Publishes a new item, replacing the previous one. Producer side only.
+     * @param value The item to publish.
+     * @return void
+     */
+    void Publish(const T &value) {
+        uint32_t current = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+        __atomic_store_n(&sequence, current + 1, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        item = value;
+        __atomic_store_n(&sequence, current + 2, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Reads the newest item if it is newer than the one last read. Consumer side only.
+     * @param value The item to copy into.
+     * @param lastSequence The sequence number of the last item read, updated on success.
+     * @return true if a newer item was read, false otherwise.
+     */
+    bool ReadIfNewer(T &value, uint32_t &lastSequence) {
+        for (int attempt = 0; attempt < 4; attempt++) {
+            uint32_t before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+            if (before / 2 == lastSequence) {
+                return false;
+            }
+            if (before & 1) {
+                continue;
+            }
+            T copy = item;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&sequence, __ATOMIC_ACQUIRE) == before) {
+                value = copy;
+                lastSequence = before / 2;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
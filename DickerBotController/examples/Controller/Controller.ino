@@ -7,24 +7,22 @@
 
 #include "DickerBotController.h"
 
-// Vars for controlling frequency of updates (currently 1000/33 = 30 Hz)
-const int updateInterval = 33;
-
 // Create an instance of the class
 DickerBotController dickerBotController;
 
 void setup() {
-  // Initialize the serial
+  // Initialize the serial, with room to buffer traffic captures
+  Serial.setTxBufferSize(4096);
   Serial.begin(115200);
 
   // Start the controller
   dickerBotController.Begin();
+
+  // Run actuation, IMU, ranging and comms as prioritized tasks
+  dickerBotController.StartTasks();
 }
 
 void loop() {
-  // Receive and send data to the socket and communicator on set frequency
-  dickerBotController.ReceiveDataFromComputer();
-  dickerBotController.ReceiveDataFromCommunicator();
-  dickerBotController.SendSensorDataToCommunicator();
-  delay(updateInterval);
+  // All work happens in the controller tasks
+  vTaskDelete(NULL);
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+/*
+    ProtocolTests.cpp - Checks ControllerProtocol's message parsing, on Linux.
+    Released into the public domain
+
+    Build and run from this directory:
+        g++ -O2 -I../../src ProtocolTests.cpp ../../src/ControllerProtocol.cpp -o ProtocolTests
+        ./ProtocolTests
+
+    Each case feeds a message to the parser the way the comms task does (the ';' already removed and
+    the fields starting after the prefix) and checks what it decodes. Exits with 1 if any case fails.
+*/
+
+#include "ControllerProtocol.h"
+#include <cstdio>
+
+static const int MOTION_QUEUE_SIZE = 64;  // As on the controller
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Parses the fields of an MQ message, e.g. "MQ,R" for "MQ,R;"
+static int ParseMotionQueue(const char* message, char &mode, MotionSegment* segments) {
+    return ControllerProtocol::ParseMotionQueueData(message + 3, mode, segments, MOTION_QUEUE_SIZE);
+}
+
+static void TestMotionQueue() {
+    MotionSegment segments[MOTION_QUEUE_SIZE];
+    char mode = 0;
+
+    // An empty replacement is valid and leaves the queue empty, so the controller stops the wheels
+    CHECK(ParseMotionQueue("MQ,R", mode, segments) == 0);
+    CHECK(mode == 'R');
+
+    CHECK(ParseMotionQueue("MQ,F", mode, segments) == 0);
+    CHECK(mode == 'F');
+
+    CHECK(ParseMotionQueue("MQ,A,250,100,1,120,2,0,0,0,0,0", mode, segments) == 2);
+    CHECK(mode == 'A');
+    CHECK(segments[0].duration_ms == 250);
+    CHECK(segments[0].left_wheel_speed == 100 && segments[0].left_wheel_direction == 1);
+    CHECK(segments[0].right_wheel_speed == 120 && segments[0].right_wheel_direction == 2);
+    CHECK(segments[1].duration_ms == 1);  // 0 ms raised to 1 ms
+
+    CHECK(ParseMotionQueue("MQ,R,100,50,1,50", mode, segments) == 0);  // Incomplete segment ignored
+    CHECK(ParseMotionQueue("MQ,X,100,50,1,50,1", mode, segments) == -1);
+}
+
+static void TestRangeFilter() {
+    RangeFilterSettings settings;
+    const int numSensors = 4;
+
+    CHECK(ControllerProtocol::ParseRangeFilterData("2,7,150,5,180", settings, numSensors));
+    CHECK(settings.sensor == 2 && settings.window == 7 && settings.max_rate_cm_s == 150);
+    CHECK(settings.min_cm == 5 && settings.max_cm == 180);
+
+    CHECK(ControllerProtocol::ParseRangeFilterData("-1,5,-1,-1,-1", settings, numSensors));  // All sensors
+    CHECK(!ControllerProtocol::ParseRangeFilterData("-7,5,200,2,200", settings, numSensors));
+    CHECK(!ControllerProtocol::ParseRangeFilterData("4,5,200,2,200", settings, numSensors));
+    CHECK(!ControllerProtocol::ParseRangeFilterData("0,5,200,2", settings, numSensors));
+}
+
+int main() {
+    TestMotionQueue();
+    TestRangeFilter();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
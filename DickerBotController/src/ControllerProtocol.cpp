@@ -0,0 +1,41 @@
+/*
+    ControllerProtocol.cpp - Parsing of the messages the DickerBot's controller receives from the communicator.
+    Released into the public domain
+*/
+
+#include "ControllerProtocol.h"
+#include <stdio.h>
+
+bool ControllerProtocol::ParseControlData(const char* fields, WheelCommand &command) {
+    return sscanf(fields, "%d,%d,%d,%d", &command.left_wheel_speed, &command.left_wheel_direction, &command.right_wheel_speed, &command.right_wheel_direction) == 4;
+}
+
+int ControllerProtocol::ParseMotionQueueData(const char* fields, char &mode, MotionSegment* segments, int capacity) {
+    mode = fields[0];
+    if (mode != 'A' && mode != 'R' && mode != 'F') {
+        return -1;
+    }
+
+    int numSegments = 0;
+    const char* cursor = fields + 1;
+    int consumed = 0;
+    while (numSegments < capacity) {
+        MotionSegment &segment = segments[numSegments];
+        int duration;
+        if (sscanf(cursor, ",%d,%d,%d,%d,%d%n", &duration, &segment.left_wheel_speed, &segment.left_wheel_direction, &segment.right_wheel_speed, &segment.right_wheel_direction, &consumed) != 5) {
+            break;
+        }
+        segment.duration_ms = duration > 0 ? duration : 1;
+        cursor += consumed;
+        numSegments++;
+    }
+    return numSegments;
+}
+
+bool ControllerProtocol::ParseSensorRates(const char* fields, int* rates) {
+    return sscanf(fields, "%d,%d,%d", &rates[0], &rates[1], &rates[2]) == 3;
+}
+
+bool ControllerProtocol::ParseRangeFilterData(const char* fields, RangeFilterSettings &settings, int numSensors) {
+    return sscanf(fields, "%d,%d,%d,%d,%d", &settings.sensor, &settings.window, &settings.max_rate_cm_s, &settings.min_cm, &settings.max_cm) == 5 && settings.sensor >= -1 && settings.sensor < numSensors;
+}
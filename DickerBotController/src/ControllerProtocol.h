@@ -0,0 +1,75 @@
+/*
+    ControllerProtocol.h - Parsing of the messages the DickerBot's controller receives from the communicator.
+    Released into the public domain
+
+    Each parser takes the fields of a message, after its prefix and without the ';' terminator.
+    Unlike the handlers that call it, free of Arduino dependencies so recorded traffic can be replayed
+    through it on Linux.
+*/
+#ifndef ControllerProtocol_h
+#define ControllerProtocol_h
+
+#include <stdint.h>
+
+struct MotionSegment {
+    uint32_t duration_ms = 0;  // Time to hold this wheel state
+    int left_wheel_speed = 0;  // 0-255
+    int left_wheel_direction = 0;  // 0 = neutral, 1 = forward, 2 = backward
+    int right_wheel_speed = 0;  // 0-255
+    int right_wheel_direction = 0;  // 0 = neutral, 1 = forward, 2 = backward
+};
+
+struct WheelCommand {
+    int left_wheel_speed = 0;  // 0-255
+    int left_wheel_direction = 0;  // 0 = neutral, 1 = forward, 2 = backward
+    int right_wheel_speed = 0;  // 0-255
+    int right_wheel_direction = 0;  // 0 = neutral, 1 = forward, 2 = backward
+};
+
+struct RangeFilterSettings {
+    int sensor = -1;  // 0 = left, 1 = front, 2 = right, 3 = back, -1 = all
+    int window = -1;  // Negative settings are left unchanged
+    int max_rate_cm_s = -1;
+    int min_cm = -1;
+    int max_cm = -1;
+};
+
+class ControllerProtocol {
+public:
+    /**
+     * @brief Parses control data, "left_wheel_speed,left_wheel_direction,right_wheel_speed,right_wheel_direction".
+     * @param fields The fields of the CD message.
+     * @param command Output for the wheel state.
+     * @return true if all four values parsed.
+     */
+    static bool ParseControlData(const char* fields, WheelCommand &command);
+
+    /**
+     * @brief Parses a motion queue batch, "mode,duration_ms,lspeed,ldir,rspeed,rdir,...".
+     * @param fields The fields of the MQ message.
+     * @param mode Output for the mode, 'A', 'R' or 'F'.
+     * @param segments The array to store the segments in. Durations of 0 are raised to 1 ms.
+     * @param capacity The size of segments. Segments beyond it are ignored.
+     * @return The number of segments parsed, -1 if the mode is unknown.
+     */
+    static int ParseMotionQueueData(const char* fields, char &mode, MotionSegment* segments, int capacity);
+
+    /**
+     * @brief Parses sampling rates, "imu_hz,temperature_hz,ranging_hz".
+     * @param fields The fields of the SR message.
+     * @param rates Output for the three rates, negative if unchanged.
+     * @return true if all three rates parsed.
+     */
+    static bool ParseSensorRates(const char* fields, int* rates);
+
+    /**
+     * @brief Parses distance filter settings, "sensor,window,max_rate_cm_s,min_cm,max_cm".
+     * @param fields The fields of the RF message.
+     * @param settings Output for the settings.
+     * @param numSensors The number of distance sensors, higher sensor numbers are rejected.
+     * @return true if all five values parsed and the sensor exists or is -1 (all sensors).
+     */
+    static bool ParseRangeFilterData(const char* fields, RangeFilterSettings &settings, int numSensors);
+};
+
+#endif
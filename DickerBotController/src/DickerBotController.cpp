@@ -6,7 +6,17 @@
 
 #include "DickerBotController.h"
 
+DickerBotController* DickerBotController::instance = nullptr;
+const char* const DickerBotController::CAPABILITIES = "mq|ts|sr|rf|pwm";
+// Temperature drifts over minutes. A ping without an echo waits ~12 ms for MAX_DISTANCE_CM, so the four take up to ~48 ms
+const int DickerBotController::MAX_SENSOR_RATES_HZ[NUM_SENSOR_CHANNELS] = {100, 10, 20};
+const int DickerBotController::DEFAULT_SENSOR_RATES_HZ[NUM_SENSOR_CHANNELS] = {30, 1, 20};
+
 DickerBotController::DickerBotController() {
+    instance = this;
+    for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+        sensorRatesHz[i] = DEFAULT_SENSOR_RATES_HZ[i];
+    }
 }
 
 void DickerBotController::Begin() {
@@ -15,22 +25,193 @@ void DickerBotController::Begin() {
     InitializeIMUSensor();
     InitializeCommunicationToCommunicator();
     InitializeController();
+    InitializeMotionQueue();
     SequenceLEDIndicator(0);
 }
 
+void DickerBotController::StartTasks() {
+    xTaskCreatePinnedToCore(&DickerBotController::MotorTask, "motor", TASK_STACK, this, MOTOR_TASK_PRIORITY, &taskStats[MOTOR_TASK].handle, MOTOR_TASK_CORE);
+    xTaskCreatePinnedToCore(&DickerBotController::ActuationTask, "actuation", TASK_STACK, this, ACTUATION_TASK_PRIORITY, &taskStats[ACTUATION_TASK].handle, ACTUATION_TASK_CORE);
+    xTaskCreatePinnedToCore(&DickerBotController::IMUTask, "imu", TASK_STACK, this, IMU_TASK_PRIORITY, &taskStats[IMU_TASK].handle, IMU_TASK_CORE);
+    xTaskCreatePinnedToCore(&DickerBotController::RangingTask, "ranging", TASK_STACK, this, RANGING_TASK_PRIORITY, &taskStats[RANGING_TASK].handle, RANGING_TASK_CORE);
+    xTaskCreatePinnedToCore(&DickerBotController::CommsTask, "comms", COMMS_TASK_STACK, this, COMMS_TASK_PRIORITY, &taskStats[COMMS_TASK].handle, COMMS_TASK_CORE);
+}
+
+void DickerBotController::MotorTask(void* parameter) {
+    DickerBotController* controller = (DickerBotController*)parameter;
+    for (;;) {
+        // One notification per motion timer tick, several if this task was held up
+        uint32_t periods = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+
+        controller->leftMotor.Update(periods);
+        controller->rightMotor.Update(periods);
+
+        controller->AccountTaskTime(MOTOR_TASK, start);
+    }
+}
+
+void DickerBotController::ActuationTask(void* parameter) {
+    DickerBotController* controller = (DickerBotController*)parameter;
+    uint32_t appliedSequence = 0;
+    for (;;) {
+        // Woken immediately by new commands, otherwise runs the safety checks periodically
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ACTUATION_PERIOD_MS));
+        int64_t start = esp_timer_get_time();
+
+        WheelCommand command;
+        uint32_t sequence = controller->wheelCommandSnapshot.Read(command);
+        if (sequence != 0 && sequence != appliedSequence) {  // 0 when comms was mid-publish, retried on the next wake
+            appliedSequence = sequence;
+            controller->SetWheelState(command.left_wheel_speed, command.left_wheel_direction, command.right_wheel_speed, command.right_wheel_direction);
+        }
+        controller->CheckControllerButton();
+
+        controller->AccountTaskTime(ACTUATION_TASK, start);
+    }
+}
+
+void DickerBotController::IMUTask(void* parameter) {
+    DickerBotController* controller = (DickerBotController*)parameter;
+    TickType_t lastWake = xTaskGetTickCount();
+    for (;;) {
+        // Temperature comes from the same read, so sample at whichever of the two is faster
+        int rate = max(controller->GetSensorRate(SENSOR_CHANNEL_IMU), controller->GetSensorRate(SENSOR_CHANNEL_TEMPERATURE));
+        if (rate == 0) {
+            vTaskDelay(pdMS_TO_TICKS(SENSOR_IDLE_PERIOD_MS));
+            lastWake = xTaskGetTickCount();
+            continue;
+        }
+        int64_t start = esp_timer_get_time();
+
+        float data[7];
+        controller->GetIMUData(data);
+        IMUData imu;
+        imu.ax = data[0];
+        imu.ay = data[1];
+        imu.az = data[2];
+        imu.gx = data[3];
+        imu.gy = data[4];
+        imu.gz = data[5];
+        imu.t = data[6];
+        controller->imuSnapshot.Publish(imu);
+
+        controller->AccountTaskTime(IMU_TASK, start);
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(1000 / rate));
+    }
+}
+
+void DickerBotController::RangingTask(void* parameter) {
+    DickerBotController* controller = (DickerBotController*)parameter;
+    TickType_t lastWake = xTaskGetTickCount();
+    uint32_t appliedConfigs[NUM_DISTANCE_SENSORS] = {0};
+    for (;;) {
+        int rate = controller->GetSensorRate(SENSOR_CHANNEL_RANGING);
+        if (rate == 0) {
+            vTaskDelay(pdMS_TO_TICKS(SENSOR_IDLE_PERIOD_MS));
+            lastWake = xTaskGetTickCount();
+            continue;
+        }
+        int64_t start = esp_timer_get_time();
+
+        int data[NUM_DISTANCE_SENSORS];
+        controller->GetDistanceData(data);
+        uint32_t timestamp = millis();
+
+        int filtered[NUM_DISTANCE_SENSORS];
+        DistanceData distance;
+        for (int i = 0; i < NUM_DISTANCE_SENSORS; i++) {
+            RangeFilterConfig config;
+            uint32_t configSequence = controller->rangeFilterConfigs[i].Read(config);
+            if (configSequence != 0 && configSequence != appliedConfigs[i]) {
+                appliedConfigs[i] = configSequence;
+                controller->rangeFilters[i].Configure(config);
+            }
+            RangeReading reading = controller->rangeFilters[i].Update(data[i], timestamp);
+            filtered[i] = reading.distance_cm;
+            distance.status[i] = reading.status;
+            distance.confidence[i] = reading.confidence;
+        }
+        distance.dL = filtered[0];
+        distance.dF = filtered[1];
+        distance.dR = filtered[2];
+        distance.dB = filtered[3];
+        controller->distanceSnapshot.Publish(distance);
+
+        controller->AccountTaskTime(RANGING_TASK, start);
+        TickType_t period = pdMS_TO_TICKS(1000 / rate);
+        if (xTaskGetTickCount() - lastWake >= period) {
+            // The sweep overran its period, let the lower priority tasks in before the next one
+            vTaskDelay(pdMS_TO_TICKS(RANGING_MIN_GAP_MS));
+            lastWake = xTaskGetTickCount();
+        }
+        else {
+            vTaskDelayUntil(&lastWake, period);
+        }
+    }
+}
+
+void DickerBotController::CommsTask(void* parameter) {
+    DickerBotController* controller = (DickerBotController*)parameter;
+    unsigned long lastChannelSend[NUM_SENSOR_CHANNELS] = {0};
+    uint32_t lastRangingUpdate = 0;
+    unsigned long lastStatsSend = 0;
+    controller->SendHelloToCommunicator();
+    for (;;) {
+        int64_t start = esp_timer_get_time();
+
+        controller->ReceiveDataFromComputer();
+        controller->ReceiveDataFromCommunicator();
+        controller->SendMotionQueueStatusToCommunicator();
+
+        unsigned long currentTime = millis();
+        int dueChannels = 0;
+        for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+            int rate = controller->GetSensorRate(i);
+            if (rate > 0 && currentTime - lastChannelSend[i] >= (unsigned long)(1000 / rate)) {
+                if (i == SENSOR_CHANNEL_RANGING) {
+                    // Only send distances the ranging task has refreshed since the last frame
+                    uint32_t rangingUpdate = controller->distanceSnapshot.GetUpdateCount();
+                    if (rangingUpdate == lastRangingUpdate) {
+                        continue;
+                    }
+                    lastRangingUpdate = rangingUpdate;
+                }
+                lastChannelSend[i] = currentTime;
+                dueChannels |= 1 << i;
+            }
+        }
+        if (dueChannels != 0) {
+            controller->SendSensorDataToCommunicator(dueChannels);
+        }
+        if (currentTime - lastStatsSend >= TASK_STATS_PERIOD_MS) {
+            lastStatsSend = currentTime;
+            controller->SendTaskStatsToCommunicator();
+            controller->SendLinkHealthToCommunicator();
+        }
+
+        controller->AccountTaskTime(COMMS_TASK, start);
+        vTaskDelay(1);
+    }
+}
+
+void DickerBotController::AccountTaskTime(int task, int64_t start_us) {
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start_us);
+    __atomic_fetch_add(&taskStats[task].busy_us, elapsed, __ATOMIC_RELAXED);
+}
+
+int DickerBotController::GetSensorRate(int channel) {
+    return __atomic_load_n(&sensorRatesHz[channel], __ATOMIC_RELAXED);
+}
+
+void DickerBotController::ConfigureMotors(const MotorDriverConfig &config) {
+    motorConfig = config;
+}
+
 void DickerBotController::InitializeWheels() {
-    pinMode(LEFT_WHEEL_EN, OUTPUT);
-    pinMode(LEFT_WHEEL_IN1, OUTPUT);
-    pinMode(LEFT_WHEEL_IN2, OUTPUT);
-    pinMode(RIGHT_WHEEL_EN, OUTPUT);
-    pinMode(RIGHT_WHEEL_IN1, OUTPUT);
-    pinMode(RIGHT_WHEEL_IN2, OUTPUT);
-    digitalWrite(LEFT_WHEEL_EN, 0);
-    digitalWrite(LEFT_WHEEL_IN1, LOW);
-    digitalWrite(LEFT_WHEEL_IN2, LOW);
-    digitalWrite(RIGHT_WHEEL_EN, 0); 
-    digitalWrite(RIGHT_WHEEL_IN1, LOW);
-    digitalWrite(RIGHT_WHEEL_IN2, LOW);
+    // The right motor is mounted mirrored, so forward is IN1 high
+    leftMotor.Begin(LEFT_WHEEL_EN, LEFT_WHEEL_IN1, LEFT_WHEEL_IN2, LEFT_WHEEL_PWM_CHANNEL, motorConfig, false, MOTION_TIMER_PERIOD_US);
+    rightMotor.Begin(RIGHT_WHEEL_EN, RIGHT_WHEEL_IN1, RIGHT_WHEEL_IN2, RIGHT_WHEEL_PWM_CHANNEL, motorConfig, true, MOTION_TIMER_PERIOD_US);
 }
 
 void DickerBotController::InitializeDistanceSensors() {
@@ -59,6 +240,12 @@ void DickerBotController::InitializeIMUSensor() {
 
 void DickerBotController::InitializeCommunicationToCommunicator() {
     controllerSerial.begin(115200, SERIAL_8N1, CONTROLLER_RX, CONTROLLER_TX);
+    traceCapture.Begin(Serial);
+    controllerSerial.onReceiveError([this](hardwareSerial_error_t error) {
+        // Runs in the UART driver's event task
+        bool overrun = error == UART_BUFFER_FULL_ERROR || error == UART_FIFO_OVF_ERROR;
+        __atomic_fetch_add(overrun ? &communicatorLinkStats.overruns : &communicatorLinkStats.errors, 1, __ATOMIC_RELAXED);
+    });
 }
 
 void DickerBotController::InitializeController() {
@@ -82,47 +269,110 @@ void DickerBotController::CheckControllerButton() {
             buttonPressed = false;
             unsigned long pressDuration = millis() - buttonPressStart;
             
-            // Handle button press here: if (pressDuration < 1000) {}
+            if (pressDuration < 1000) {
+                // Safety stop: drop any planned motion and stop the wheels. Applied here rather than
+                // published, the comms task is the only writer of wheelCommandSnapshot
+                ClearMotionQueue();
+                SetWheelState(0, 0, 0, 0);
+            }
         }
     }
 }
 
-void DickerBotController::SetLeftWheelSpeed(int speed) {
-    digitalWrite(LEFT_WHEEL_EN, speed);
+void DickerBotController::InitializeMotionQueue() {
+    motionTimer = timerBegin(MOTION_TIMER, 80, true);  // 80 MHz APB / 80 = 1 tick per us
+    timerAttachInterrupt(motionTimer, &DickerBotController::OnMotionTimer, true);
+    timerAlarmWrite(motionTimer, MOTION_TIMER_PERIOD_US, true);
+    timerAlarmEnable(motionTimer);
+}
+
+void IRAM_ATTR DickerBotController::OnMotionTimer() {
+    DickerBotController* controller = instance;
+    portENTER_CRITICAL_ISR(&controller->motionQueueMux);
+    if (controller->motionSegmentActive && --controller->motionSegmentRemaining == 0) {
+        controller->motionSegmentActive = false;
+        controller->motionSegmentsCompleted++;
+        if (controller->motionQueueCount == 0) {
+            controller->SetWheelState(0, 0, 0, 0);  // End of plan
+        }
+    }
+    if (!controller->motionSegmentActive && controller->motionQueueCount > 0) {
+        MotionSegment &segment = controller->motionQueue[controller->motionQueueHead];
+        controller->motionQueueHead = (controller->motionQueueHead + 1) % MOTION_QUEUE_SIZE;
+        controller->motionQueueCount--;
+        controller->motionSegmentActive = true;
+        controller->motionSegmentRemaining = segment.duration_ms > 0 ? segment.duration_ms : 1;
+        controller->SetWheelState(segment.left_wheel_speed, segment.left_wheel_direction, segment.right_wheel_speed, segment.right_wheel_direction);
+    }
+    portEXIT_CRITICAL_ISR(&controller->motionQueueMux);
+
+    // LEDC and GPIO writes are not interrupt safe, the motor task does them
+    TaskHandle_t motorTask = controller->taskStats[MOTOR_TASK].handle;
+    if (motorTask != nullptr) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(motorTask, &woken);
+        if (woken == pdTRUE) {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
+
+void DickerBotController::ClearMotionQueue() {
+    portENTER_CRITICAL(&motionQueueMux);
+    motionQueueCount = 0;
+    motionSegmentActive = false;
+    portEXIT_CRITICAL(&motionQueueMux);
+}
+
+int DickerBotController::GetMotionQueueDepth() {
+    portENTER_CRITICAL(&motionQueueMux);
+    int depth = motionQueueCount + (motionSegmentActive ? 1 : 0);
+    portEXIT_CRITICAL(&motionQueueMux);
+    return depth;
+}
+
+void DickerBotController::CommandWheelState(const WheelCommand &command) {
+    wheelCommandSnapshot.Publish(command);
+    if (taskStats[ACTUATION_TASK].handle != nullptr) {
+        xTaskNotifyGive(taskStats[ACTUATION_TASK].handle);
+    }
+}
+
+void IRAM_ATTR DickerBotController::SetWheelState(int left_wheel_speed, int left_wheel_direction, int right_wheel_speed, int right_wheel_direction) {
+    leftMotor.SetTarget(left_wheel_speed, left_wheel_direction);
+    rightMotor.SetTarget(right_wheel_speed, right_wheel_direction);
 }
 
-void DickerBotController::SetRightWheelSpeed(int speed) {
-    digitalWrite(RIGHT_WHEEL_EN, speed);
+void IRAM_ATTR DickerBotController::SetLeftWheelSpeed(int speed) {
+    leftMotor.SetTargetSpeed(speed);
 }
 
-void DickerBotController::SetLeftWheelForward() {
-    digitalWrite(LEFT_WHEEL_IN1, LOW);
-    digitalWrite(LEFT_WHEEL_IN2, HIGH);
+void IRAM_ATTR DickerBotController::SetRightWheelSpeed(int speed) {
+    rightMotor.SetTargetSpeed(speed);
 }
 
-void DickerBotController::SetLeftWheelBackward() {
-    digitalWrite(LEFT_WHEEL_IN1, HIGH);
-    digitalWrite(LEFT_WHEEL_IN2, LOW);
+void IRAM_ATTR DickerBotController::SetLeftWheelForward() {
+    leftMotor.SetTargetDirection(MOTOR_FORWARD);
 }
 
-void DickerBotController::SetLeftWheelNeutral() {
-    digitalWrite(LEFT_WHEEL_IN1, LOW);
-    digitalWrite(LEFT_WHEEL_IN2, LOW);
+void IRAM_ATTR DickerBotController::SetLeftWheelBackward() {
+    leftMotor.SetTargetDirection(MOTOR_BACKWARD);
 }
 
-void DickerBotController::SetRightWheelForward() {
-    digitalWrite(RIGHT_WHEEL_IN1, HIGH);
-    digitalWrite(RIGHT_WHEEL_IN2, LOW);
+void IRAM_ATTR DickerBotController::SetLeftWheelNeutral() {
+    leftMotor.SetTargetDirection(MOTOR_NEUTRAL);
 }
 
-void DickerBotController::SetRightWheelBackward() {
-    digitalWrite(RIGHT_WHEEL_IN1, LOW);
-    digitalWrite(RIGHT_WHEEL_IN2, HIGH);
+void IRAM_ATTR DickerBotController::SetRightWheelForward() {
+    rightMotor.SetTargetDirection(MOTOR_FORWARD);
 }
 
-void DickerBotController::SetRightWheelNeutral() {
-    digitalWrite(RIGHT_WHEEL_IN1, LOW);
-    digitalWrite(RIGHT_WHEEL_IN2, LOW);
+void IRAM_ATTR DickerBotController::SetRightWheelBackward() {
+    rightMotor.SetTargetDirection(MOTOR_BACKWARD);
+}
+
+void IRAM_ATTR DickerBotController::SetRightWheelNeutral() {
+    rightMotor.SetTargetDirection(MOTOR_NEUTRAL);
 }
 
 void DickerBotController::GetDistanceData(int* data) {
@@ -144,64 +394,206 @@ void DickerBotController::GetIMUData(float* data) {
     data[6] = temp.temperature;
 }
 
-void DickerBotController::SendSensorDataToCommunicator() {
-    int distanceData[4];
-    GetDistanceData(distanceData);
-    float imuData[7];
-    GetIMUData(imuData);
-    controllerSerial.print("SD,");
-    for (int i = 0; i < 7; i++) {
-        controllerSerial.print(imuData[i]);
-        controllerSerial.print(",");
+void DickerBotController::SendSensorDataToCommunicator(int channels) {
+    // Frame: "SD,mask" then the values of each channel in the mask, in channel order
+    static IMUData imu;  // A read that meets the writer mid-update keeps the previous values
+    imuSnapshot.Read(imu);
+    static DistanceData distance;
+    distanceSnapshot.Read(distance);
+    communicatorLink.printf("SD,%d", channels);
+    if (channels & (1 << SENSOR_CHANNEL_IMU)) {
+        communicatorLink.printf(",%.2f,%.2f,%.2f,%.2f,%.2f,%.2f", imu.ax, imu.ay, imu.az, imu.gx, imu.gy, imu.gz);
+    }
+    if (channels & (1 << SENSOR_CHANNEL_TEMPERATURE)) {
+        communicatorLink.printf(",%.2f", imu.t);
+    }
+    if (channels & (1 << SENSOR_CHANNEL_RANGING)) {
+        communicatorLink.printf(",%d,%d,%d,%d", distance.dL, distance.dF, distance.dR, distance.dB);
+        for (int i = 0; i < NUM_DISTANCE_SENSORS; i++) {
+            communicatorLink.printf(",%u", distance.status[i]);
+        }
+        for (int i = 0; i < NUM_DISTANCE_SENSORS; i++) {
+            communicatorLink.printf(",%u", distance.confidence[i]);
+        }
+    }
+    communicatorLink.print(";");
+}
+
+void DickerBotController::HandleSensorRateDataFromCommunicator(String data) {
+    int rates[NUM_SENSOR_CHANNELS];
+    if (ControllerProtocol::ParseSensorRates(data.c_str() + 3, rates)) {
+        for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+            if (rates[i] >= 0) {
+                __atomic_store_n(&sensorRatesHz[i], constrain(rates[i], 0, MAX_SENSOR_RATES_HZ[i]), __ATOMIC_RELAXED);
+            }
+        }
+    }
+    else {
+        communicatorLinkStats.parse_failures++;
+    }
+    SendSensorRatesToCommunicator();
+}
+
+void DickerBotController::HandleRangeFilterDataFromCommunicator(String data) {
+    RangeFilterSettings settings;
+    if (!ControllerProtocol::ParseRangeFilterData(data.c_str() + 3, settings, NUM_DISTANCE_SENSORS)) {
+        communicatorLinkStats.parse_failures++;
+        return;
+    }
+
+    for (int i = 0; i < NUM_DISTANCE_SENSORS; i++) {
+        if (settings.sensor >= 0 && i != settings.sensor) {
+            continue;
+        }
+        RangeFilterConfig config;
+        rangeFilterConfigs[i].Read(config);
+        config.window = settings.window >= 0 ? constrain(settings.window, 1, RangeFilterConfig::MAX_WINDOW) : config.window;
+        config.max_rate_cm_s = settings.max_rate_cm_s >= 0 ? settings.max_rate_cm_s : config.max_rate_cm_s;
+        config.min_cm = settings.min_cm >= 0 ? settings.min_cm : config.min_cm;
+        config.max_cm = max(settings.max_cm >= 0 ? settings.max_cm : config.max_cm, config.min_cm);
+        if (settings.window >= 0 || settings.max_rate_cm_s >= 0 || settings.min_cm >= 0 || settings.max_cm >= 0) {
+            rangeFilterConfigs[i].Publish(config);
+        }
+        communicatorLink.printf("RF,%d,%d,%d,%d,%d;", i, config.window, config.max_rate_cm_s, config.min_cm, config.max_cm);
     }
-    for (int i = 0; i < 4; i++) {
-        controllerSerial.print(distanceData[i]);
-        controllerSerial.print(i < 3 ? "," : ";");
+}
+
+void DickerBotController::SendSensorRatesToCommunicator() {
+    communicatorLink.printf("SR,%d,%d,%d;", sensorRatesHz[SENSOR_CHANNEL_IMU], sensorRatesHz[SENSOR_CHANNEL_TEMPERATURE], sensorRatesHz[SENSOR_CHANNEL_RANGING]);
+}
+
+void DickerBotController::SendTaskStatsToCommunicator() {
+    static int64_t lastReport = 0;
+    int64_t now = esp_timer_get_time();
+    uint32_t window = lastReport > 0 ? (uint32_t)(now - lastReport) : 1;
+    lastReport = now;
+
+    // Per task: CPU use in tenths of a percent of one core, then free stack in bytes
+    communicatorLink.print("TS");
+    for (int i = 0; i < NUM_TASKS; i++) {
+        uint32_t busy = __atomic_exchange_n(&taskStats[i].busy_us, 0, __ATOMIC_RELAXED);
+        uint32_t cpu = (uint32_t)((uint64_t)busy * 1000 / window);
+        uint32_t stack = taskStats[i].handle != nullptr ? uxTaskGetStackHighWaterMark(taskStats[i].handle) : 0;
+        communicatorLink.printf(",%u,%u", cpu, stack);
     }
+    communicatorLink.print(";");
+}
+
+void DickerBotController::SendLinkHealthToCommunicator() {
+    const LinkStats &stats = communicatorLinkStats;
+    communicatorLink.printf("LH,controller,%u,%u,%u,%u,%u,%u,%u,%u,%u;", stats.rx_bytes, stats.rx_frames, stats.tx_bytes, stats.tx_frames,
+                            stats.parse_failures, __atomic_load_n(&stats.errors, __ATOMIC_RELAXED), __atomic_load_n(&stats.overruns, __ATOMIC_RELAXED),
+                            stats.high_water, stats.reconnects);
 }
 
 void DickerBotController::ReceiveDataFromCommunicator() {
-    if (controllerSerial.available()) {
-        String data = controllerSerial.readStringUntil(';');
-        if (data.length() == 0) return;
+    uint32_t waiting = controllerSerial.available();
+    communicatorLinkStats.high_water = max(communicatorLinkStats.high_water, waiting);
+    while (controllerSerial.available()) {
+        char c = controllerSerial.read();
+        communicatorLinkStats.rx_bytes++;
+        traceCapture.Capture(false, (const uint8_t*)&c, 1);
+        if (c != ';') {
+            if (communicatorReceiveBuffer.length() < MAX_MESSAGE_LENGTH) {
+                communicatorReceiveBuffer += c;
+            }
+            continue;
+        }
+
+        communicatorLinkStats.rx_frames++;
+        if (communicatorReceiveBuffer.length() >= MAX_MESSAGE_LENGTH) {
+            // Truncated, drop it rather than act on part of a command
+            __atomic_fetch_add(&communicatorLinkStats.overruns, 1, __ATOMIC_RELAXED);
+            communicatorReceiveBuffer = "";
+            continue;
+        }
+        String data = communicatorReceiveBuffer;
+        communicatorReceiveBuffer = "";
+        if (data.length() == 0) continue;
         
         if (data.startsWith("CD,")) {
             HandleControlDataFromCommunicator(data);
         } 
+        else if (data.startsWith("MQ,")) {
+            HandleMotionQueueDataFromCommunicator(data);
+        }
+        else if (data.startsWith("SR,")) {
+            HandleSensorRateDataFromCommunicator(data);
+        }
+        else if (data.startsWith("RF,")) {
+            HandleRangeFilterDataFromCommunicator(data);
+        }
+        else if (data.startsWith("HL,")) {
+            // The communicator says hello when it starts and on every socket connect
+            communicatorLinkStats.reconnects++;
+            SendHelloToCommunicator();
+        }
         else if (data.startsWith("RD,")) {
             HandleConnectionDataFromCommunicator(data);
         }
+        else {
+            communicatorLinkStats.parse_failures++;
+        }
     }
 }
 
 void DickerBotController::HandleControlDataFromCommunicator(String data) {
-    data = data.substring(3);
-    int left_wheel_speed, left_wheel_direction, right_wheel_speed, right_wheel_direction;
-    int numValues = sscanf(data.c_str(), "%d,%d,%d,%d", &left_wheel_speed, &left_wheel_direction, &right_wheel_speed, &right_wheel_direction);
-    if (numValues == 4) {
-        SetLeftWheelSpeed(left_wheel_speed);
-        if (left_wheel_direction == 0) {
-            SetLeftWheelNeutral();
-        } 
-        else if (left_wheel_direction == 1) {
-            SetLeftWheelForward();
-        } 
-        else if (left_wheel_direction == 2) {
-            SetLeftWheelBackward();
-        }
-        SetRightWheelSpeed(right_wheel_speed);
-        if (right_wheel_direction == 0) {
-            SetRightWheelNeutral();
-        }
-        else if (right_wheel_direction == 1) {
-            SetRightWheelForward();
-        }
-        else if (right_wheel_direction == 2) {
-            SetRightWheelBackward();
-        }
+    WheelCommand command;
+    if (ControllerProtocol::ParseControlData(data.c_str() + 3, command)) {
+        // A direct command overrides any planned motion
+        ClearMotionQueue();
+        CommandWheelState(command);
+    }
+    else {
+        communicatorLinkStats.parse_failures++;
     }
 }
 
+void DickerBotController::HandleMotionQueueDataFromCommunicator(String data) {
+    char mode;
+    int numSegments = ControllerProtocol::ParseMotionQueueData(data.c_str() + 3, mode, motionQueueBatch, MOTION_QUEUE_SIZE);
+    if (numSegments < 0) {
+        communicatorLinkStats.parse_failures++;
+        return;
+    }
+
+    portENTER_CRITICAL(&motionQueueMux);
+    if (mode != 'A') {
+        motionQueueCount = 0;
+        motionSegmentActive = false;
+    }
+    for (int i = 0; i < numSegments && motionQueueCount < MOTION_QUEUE_SIZE; i++) {
+        motionQueue[(motionQueueHead + motionQueueCount) % MOTION_QUEUE_SIZE] = motionQueueBatch[i];
+        motionQueueCount++;
+    }
+    bool emptied = mode != 'A' && motionQueueCount == 0;
+    portEXIT_CRITICAL(&motionQueueMux);
+
+    if (emptied) {  // Nothing left to run, so don't leave the wheels in the cancelled segment's state
+        WheelCommand stop;
+        CommandWheelState(stop);
+    }
+    SendMotionQueueStatusToCommunicator();
+}
+
+void DickerBotController::SendMotionQueueStatusToCommunicator() {
+    portENTER_CRITICAL(&motionQueueMux);
+    int depth = motionQueueCount + (motionSegmentActive ? 1 : 0);
+    uint32_t completed = motionSegmentsCompleted;
+    portEXIT_CRITICAL(&motionQueueMux);
+
+    if (depth == reportedMotionQueueDepth && completed == reportedMotionSegmentsCompleted) {
+        return;
+    }
+    reportedMotionQueueDepth = depth;
+    reportedMotionSegmentsCompleted = completed;
+    communicatorLink.printf("QS,%d,%u;", depth, completed);
+}
+
+void DickerBotController::SendHelloToCommunicator() {
+    communicatorLink.printf("HL,%d,%s,%d;", PROTOCOL_VERSION, CAPABILITIES, MAX_SENSOR_RATES_HZ[SENSOR_CHANNEL_IMU]);
+}
+
 void DickerBotController::HandleConnectionDataFromCommunicator(String data) {
     Serial.print(data + ";");
 }
@@ -214,11 +606,31 @@ void DickerBotController::ReceiveDataFromComputer() {
         if (data.startsWith("WD,")) {
             HandleConnectionDataFromComputer(data);
         } 
+        else if (data.startsWith("TC,")) {
+            HandleTraceCaptureDataFromComputer(data);
+        }
     }
 }
 
 void DickerBotController::HandleConnectionDataFromComputer(String data) {
-    controllerSerial.print(data + ";");
+    communicatorLink.print(data + ";");
+}
+
+void DickerBotController::HandleTraceCaptureDataFromComputer(String data) {
+    int enabled;
+    long baud = 0;
+    if (sscanf(data.c_str() + 3, "%d,%ld", &enabled, &baud) < 1) {
+        return;
+    }
+
+    // Acknowledge at the old rate, then switch so the capture has room for both directions of the link
+    traceCapture.SetEnabled(false);
+    Serial.printf("TC,%d;", enabled != 0);
+    Serial.flush();
+    if (baud > 0) {
+        Serial.updateBaudRate(baud);
+    }
+    traceCapture.SetEnabled(enabled != 0);
 }
 
 void DickerBotController::SequenceLEDIndicator(int event) {
@@ -12,6 +12,31 @@
 #include <Adafruit_Sensor.h>
 #include <Wire.h>
 #include <HardwareSerial.h>
+#include "Snapshot.h"
+#include "RangeFilter.h"
+#include "LinkStats.h"
+#include "ControllerProtocol.h"
+#include "TraceCapture.h"
+#include "MotorDriver.h"
+
+struct IMUData {
+    float ax = 999, ay = 999, az = 999;  // Accelerometer
+    float gx = 999, gy = 999, gz = 999;  // Gyroscope
+    float t = 999;  // Temperature
+};
+
+struct DistanceData {
+    int dL = 999, dF = 999, dR = 999, dB = 999;  // Distance sensors, filtered
+    uint8_t status[4] = {RANGE_NO_ECHO, RANGE_NO_ECHO, RANGE_NO_ECHO, RANGE_NO_ECHO};  // RangeStatus per sensor, left, front, right, back
+    uint8_t confidence[4] = {0, 0, 0, 0};  // 0-100 per sensor
+};
+
+enum SensorChannel { SENSOR_CHANNEL_IMU = 0, SENSOR_CHANNEL_TEMPERATURE, SENSOR_CHANNEL_RANGING, NUM_SENSOR_CHANNELS };  // Bit n of an SD channel mask
+
+struct TaskStats {
+    TaskHandle_t handle = nullptr;
+    uint32_t busy_us = 0;  // Time spent working since the last report, written by the owning task
+};
 
 class DickerBotController {
 private:
@@ -22,6 +47,11 @@ private:
     static const int RIGHT_WHEEL_EN = 19;
     static const int RIGHT_WHEEL_IN1 = 27;
     static const int RIGHT_WHEEL_IN2 = 32;
+    static const int LEFT_WHEEL_PWM_CHANNEL = 0;
+    static const int RIGHT_WHEEL_PWM_CHANNEL = 1;
+    MotorDriverConfig motorConfig;
+    MotorDriver leftMotor;  // Commanded by any task or the motion timer, ramped by the motor task
+    MotorDriver rightMotor;
 
     // ----- Distance Sensors -----
     static const int LEFT_DISTANCE_SENSOR_TRIGGER = 33;
@@ -32,10 +62,14 @@ private:
     static const int RIGHT_DISTANCE_SENSOR_ECHO = 36;
     static const int BACK_DISTANCE_SENSOR_TRIGGER = 18;
     static const int BACK_DISTANCE_SENSOR_ECHO = 39;
-    NewPing leftDistanceSensor = NewPing(LEFT_DISTANCE_SENSOR_TRIGGER, LEFT_DISTANCE_SENSOR_ECHO);
-    NewPing frontDistanceSensor = NewPing(FRONT_DISTANCE_SENSOR_TRIGGER, FRONT_DISTANCE_SENSOR_ECHO);
-    NewPing rightDistanceSensor = NewPing(RIGHT_DISTANCE_SENSOR_TRIGGER, RIGHT_DISTANCE_SENSOR_ECHO);
-    NewPing backDistanceSensor = NewPing(BACK_DISTANCE_SENSOR_TRIGGER, BACK_DISTANCE_SENSOR_ECHO);
+    static const int MAX_DISTANCE_CM = 200;  // Bounds how long a ping waits for an echo (~57 us per cm)
+    NewPing leftDistanceSensor = NewPing(LEFT_DISTANCE_SENSOR_TRIGGER, LEFT_DISTANCE_SENSOR_ECHO, MAX_DISTANCE_CM);
+    NewPing frontDistanceSensor = NewPing(FRONT_DISTANCE_SENSOR_TRIGGER, FRONT_DISTANCE_SENSOR_ECHO, MAX_DISTANCE_CM);
+    NewPing rightDistanceSensor = NewPing(RIGHT_DISTANCE_SENSOR_TRIGGER, RIGHT_DISTANCE_SENSOR_ECHO, MAX_DISTANCE_CM);
+    NewPing backDistanceSensor = NewPing(BACK_DISTANCE_SENSOR_TRIGGER, BACK_DISTANCE_SENSOR_ECHO, MAX_DISTANCE_CM);
+    static const int NUM_DISTANCE_SENSORS = 4;
+    RangeFilter rangeFilters[NUM_DISTANCE_SENSORS];  // Owned by the ranging task
+    Snapshot<RangeFilterConfig> rangeFilterConfigs[NUM_DISTANCE_SENSORS];  // Comms -> ranging
 
     // ----- IMU Sensor -----
     static const int IMU_SENSOR_SDA = 21;
@@ -46,11 +80,122 @@ private:
     static const int CONTROLLER_TX = 13;
     static const int CONTROLLER_RX = 4;
     HardwareSerial controllerSerial = HardwareSerial(2);
+    LinkStats communicatorLinkStats;  // Owned by the comms task, except line errors
+    TraceCapture traceCapture;  // Owned by the comms task
+    CapturingPrint capturedSerial = CapturingPrint(controllerSerial, traceCapture, true);
+    CountingPrint communicatorLink = CountingPrint(capturedSerial, communicatorLinkStats);  // All writes to the communicator go through here
 
     // ----- Controller -----
     static const int CONTROLLER_STATUS_LED = 5;
     static const int CONTROLLER_BUTTON = 15;
 
+    // ----- Capabilities -----
+    static const int PROTOCOL_VERSION = 3;
+    static const char* const CAPABILITIES;  // '|'-separated feature list reported in the hello
+
+    // ----- Tasks -----
+    // Motor, actuation and comms share core 1; the blocking ping and I2C reads get core 0 to themselves
+    static const int MOTOR_TASK_PRIORITY = 6;
+    static const int ACTUATION_TASK_PRIORITY = 5;
+    static const int IMU_TASK_PRIORITY = 4;
+    static const int RANGING_TASK_PRIORITY = 3;
+    static const int COMMS_TASK_PRIORITY = 2;
+    static const int MOTOR_TASK_CORE = 1;
+    static const int ACTUATION_TASK_CORE = 1;
+    static const int IMU_TASK_CORE = 0;
+    static const int RANGING_TASK_CORE = 0;
+    static const int COMMS_TASK_CORE = 1;
+    static const int TASK_STACK = 4096;
+    static const int COMMS_TASK_STACK = 6144;  // Message parsing and formatted output, TS reports the headroom left
+    static const int ACTUATION_PERIOD_MS = 5;  // 200 Hz safety checks, commands apply immediately
+    static const int SENSOR_IDLE_PERIOD_MS = 100;  // How often a disabled sensor task checks for a new rate
+    static const int RANGING_MIN_GAP_MS = 5;  // Idle time after a ranging sweep that overran its period
+    static const int TASK_STATS_PERIOD_MS = 1000;  // 1 Hz, link health is sent with the task stats
+    enum TaskId { ACTUATION_TASK = 0, IMU_TASK, RANGING_TASK, COMMS_TASK, MOTOR_TASK, NUM_TASKS };  // TS order, new tasks go last
+    TaskStats taskStats[NUM_TASKS];
+    Snapshot<IMUData> imuSnapshot;
+    Snapshot<DistanceData> distanceSnapshot;
+    Snapshot<WheelCommand> wheelCommandSnapshot;  // Comms -> actuation
+    static const int MAX_SENSOR_RATES_HZ[NUM_SENSOR_CHANNELS];  // IMU, temperature, ranging
+    static const int DEFAULT_SENSOR_RATES_HZ[NUM_SENSOR_CHANNELS];
+    int sensorRatesHz[NUM_SENSOR_CHANNELS];  // Sampling and send rate per channel, 0 = off. Written by the comms task
+    static const unsigned int MAX_MESSAGE_LENGTH = 1280;  // Fits a full motion queue batch
+    String communicatorReceiveBuffer;
+
+    /**
+     * @brief Entry point of the motor task, which ramps the wheel outputs each time the motion timer wakes it.
+     * @param parameter The controller instance.
+     * @return void
+     */
+    static void MotorTask(void* parameter);
+
+    /**
+     * @brief Entry point of the actuation/safety task.
+     * @param parameter The controller instance.
+     * @return void
+     */
+    static void ActuationTask(void* parameter);
+
+    /**
+     * @brief Entry point of the IMU task.
+     * @param parameter The controller instance.
+     * @return void
+     */
+    static void IMUTask(void* parameter);
+
+    /**
+     * @brief Entry point of the ranging task.
+     * @param parameter The controller instance.
+     * @return void
+     */
+    static void RangingTask(void* parameter);
+
+    /**
+     * @brief Entry point of the comms task.
+     * @param parameter The controller instance.
+     * @return void
+     */
+    static void CommsTask(void* parameter);
+
+    /**
+     * @brief Adds working time to a task's CPU usage.
+     * @param task The TaskId of the task.
+     * @param start_us The esp_timer time the work started at.
+     * @return void
+     */
+    void AccountTaskTime(int task, int64_t start_us);
+
+    /**
+     * @brief Gets the current rate of a sensor channel.
+     * @param channel The SensorChannel.
+     * @return The rate in Hz, 0 if the channel is off.
+     */
+    int GetSensorRate(int channel);
+
+    // ----- Motion Queue -----
+    static const int MOTION_QUEUE_SIZE = 64;
+    static const int MOTION_TIMER = 0;
+    static const int MOTION_TIMER_PERIOD_US = 1000;  // 1 ms segment resolution and 1 kHz motor updates
+    static DickerBotController* instance;
+    hw_timer_t* motionTimer = nullptr;
+    portMUX_TYPE motionQueueMux = portMUX_INITIALIZER_UNLOCKED;
+    MotionSegment motionQueue[MOTION_QUEUE_SIZE];
+    MotionSegment motionQueueBatch[MOTION_QUEUE_SIZE];  // MQ parse buffer, owned by the comms task rather than on its stack
+    int motionQueueHead = 0;
+    int motionQueueCount = 0;
+    bool motionSegmentActive = false;
+    uint32_t motionSegmentRemaining = 0;
+    uint32_t motionSegmentsCompleted = 0;
+    int reportedMotionQueueDepth = -1;
+    uint32_t reportedMotionSegmentsCompleted = 0;
+
+    /**
+     * @brief Advances the motion queue by one timer tick and wakes the motor task.
+     * @return void
+     * @warning Runs in interrupt context.
+     */
+    static void OnMotionTimer();
+
 public:
     DickerBotController();
 
@@ -61,6 +206,21 @@ public:
      */
     void Begin();
 
+    /**
+     * @brief Starts the motor, actuation, IMU, ranging and comms tasks.
+     * @return void
+     * @warning This function should be called once in setup() following Begin(). The Arduino loop is unused afterwards.
+     */
+    void StartTasks();
+
+    /**
+     * @brief Sets the PWM frequency, resolution and ramp times of the wheel motors.
+     * @param config The motor settings.
+     * @return void
+     * @warning This function should be called before Begin(), which applies the settings.
+     */
+    void ConfigureMotors(const MotorDriverConfig &config);
+
     /**
      * @brief Starts the wheels.
      * @return void
@@ -92,21 +252,21 @@ public:
     void InitializeController();
 
     /**
-     * @brief Checks and handles multi purpose button press.
+     * @brief Checks and handles multi purpose button press. A short press stops the wheels.
      * @return void
      */
     void CheckControllerButton();
 
     /**
-     * @brief Sets left wheel to a speed.
-     * @param speed The speed to set the left wheel to.
+     * @brief Sets left wheel to a speed, reached within the ramp limits.
+     * @param speed The speed to set the left wheel to (0-255).
      * @return void
      */
     void SetLeftWheelSpeed(int speed);
 
     /**
-     * @brief Sets right wheel to a speed.
-     * @param speed The speed to set the right wheel to.
+     * @brief Sets right wheel to a speed, reached within the ramp limits.
+     * @param speed The speed to set the right wheel to (0-255).
      * @return void
      */
     void SetRightWheelSpeed(int speed);
@@ -124,7 +284,7 @@ public:
     void SetLeftWheelBackward();
 
     /**
-     * @brief Sets left wheel to neutral.
+     * @brief Sets left wheel to neutral, letting it coast.
      * @return void
      */
     void SetLeftWheelNeutral();
@@ -142,11 +302,47 @@ public:
     void SetRightWheelBackward();
     
     /**
-     * @brief Sets right wheel to neutral.
+     * @brief Sets right wheel to neutral, letting it coast.
      * @return void
      */
     void SetRightWheelNeutral();
 
+    /**
+     * @brief Hands a wheel state to the actuation task, which applies it immediately.
+     * @param command The wheel state to apply.
+     * @return void
+     * @warning Comms task only, the snapshot has a single writer.
+     */
+    void CommandWheelState(const WheelCommand &command);
+
+    /**
+     * @brief Applies a speed and direction to both wheels.
+     * @param left_wheel_speed The speed of the left wheel (0-255), the braking strength when braking.
+     * @param left_wheel_direction The direction of the left wheel (0 = neutral, 1 = forward, 2 = backward, 3 = brake).
+     * @param right_wheel_speed The speed of the right wheel (0-255), the braking strength when braking.
+     * @param right_wheel_direction The direction of the right wheel (0 = neutral, 1 = forward, 2 = backward, 3 = brake).
+     * @return void
+     */
+    void SetWheelState(int left_wheel_speed, int left_wheel_direction, int right_wheel_speed, int right_wheel_direction);
+
+    /**
+     * @brief Starts the hardware timer that executes the motion queue.
+     * @return void
+     */
+    void InitializeMotionQueue();
+
+    /**
+     * @brief Clears all pending and running motion segments without touching the wheels.
+     * @return void
+     */
+    void ClearMotionQueue();
+
+    /**
+     * @brief Gets the number of pending motion segments, including the running one.
+     * @return The motion queue depth.
+     */
+    int GetMotionQueueDepth();
+
     /**
      * @brief Gets the distance data from the distance sensors.
      * @param data The array to store the distance data in.
@@ -162,13 +358,47 @@ public:
     void GetIMUData(float* data);
 
     /**
-     * @brief Sends sensor data to the communicator module.
+     * @brief Sends the latest sensor snapshots of the due channels to the communicator module.
+     * @param channels Mask of the SensorChannels to send.
+     * @return void
+     */
+    void SendSensorDataToCommunicator(int channels);
+
+    /**
+     * @brief Handles sampling rate data from the communicator module and reports the applied rates.
+     * @param data The data received from the communicator module, "SR,imu_hz,temperature_hz,ranging_hz". Negative rates are left unchanged.
+     * @return void
+     */
+    void HandleSensorRateDataFromCommunicator(String data);
+
+    /**
+     * @brief Sends the current sampling rate of each sensor channel to the communicator module.
+     * @return void
+     */
+    void SendSensorRatesToCommunicator();
+
+    /**
+     * @brief Handles distance filter settings from the communicator module and reports the applied settings.
+     * @param data The data received from the communicator module, "RF,sensor,window,max_rate_cm_s,min_cm,max_cm".
+     * Sensor -1 applies to all four, negative settings are left unchanged.
      * @return void
      */
-    void SendSensorDataToCommunicator();
+    void HandleRangeFilterDataFromCommunicator(String data);
 
     /**
-     * @brief Receives data from the communicator module.
+     * @brief Sends per-task CPU usage and stack high-water marks to the communicator module.
+     * @return void
+     */
+    void SendTaskStatsToCommunicator();
+
+    /**
+     * @brief Sends the communicator link's traffic and error counters to the communicator module.
+     * @return void
+     */
+    void SendLinkHealthToCommunicator();
+
+    /**
+     * @brief Receives all pending data from the communicator module without blocking.
      * @return void
      */
     void ReceiveDataFromCommunicator();
@@ -180,6 +410,25 @@ public:
      */
     void HandleControlDataFromCommunicator(String data);
 
+    /**
+     * @brief Handles motion queue data from the communicator module.
+     * @param data The data received from the communicator module, "MQ,mode,duration,lspeed,ldir,rspeed,rdir,...".
+     * @return void
+     */
+    void HandleMotionQueueDataFromCommunicator(String data);
+
+    /**
+     * @brief Sends the motion queue depth and completed segment count when they change.
+     * @return void
+     */
+    void SendMotionQueueStatusToCommunicator();
+
+    /**
+     * @brief Sends protocol version, capabilities and the highest channel rate to the communicator module.
+     * @return void
+     */
+    void SendHelloToCommunicator();
+
     /**
      * @brief Handles connection data from the communicator module.
      * @param data The data received from the communicator module.
@@ -200,6 +449,13 @@ public:
      */
     void HandleConnectionDataFromComputer(String data);
 
+    /**
+     * @brief Handles trace capture data from the computer, turning capture of the communicator link on or off.
+     * @param data The data received from the computer, "TC,enabled,baud". A baud rate of 0 keeps the current one.
+     * @return void
+     */
+    void HandleTraceCaptureDataFromComputer(String data);
+
     /**
      * @brief Sequences the LED indicator for a given event.
      * @param event The event number to sequence the LED for.
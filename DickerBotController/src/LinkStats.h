@@ -0,0 +1,53 @@
+/*
+    LinkStats.h - Traffic and error counters for the DickerBot's serial and socket links.
+    Released into the public domain
+*/
+#ifndef LinkStats_h
+#define LinkStats_h
+
+#include <Arduino.h>
+
+// Counters since boot. Each is written by one task; 32-bit loads are atomic, so any task may read them
+struct LinkStats {
+    uint32_t rx_bytes = 0;
+    uint32_t rx_frames = 0;
+    uint32_t tx_bytes = 0;
+    uint32_t tx_frames = 0;
+    uint32_t parse_failures = 0;  // Frames dropped because they could not be parsed
+    uint32_t errors = 0;  // Line errors (UART framing, parity, break) or failed sends
+    uint32_t overruns = 0;  // Data lost to a full buffer or queue
+    uint32_t high_water = 0;  // Deepest backlog seen
+    uint32_t reconnects = 0;  // Times the link was set up again
+};
+
+/*
+    Print adapter that counts the bytes and ';'-terminated frames written through it.
+*/
+class CountingPrint : public Print {
+private:
+    Print &output;
+    LinkStats &stats;
+
+public:
+    CountingPrint(Print &output, LinkStats &stats) : output(output), stats(stats) {}
+
+    using Print::write;
+
+    size_t write(uint8_t c) override {
+        size_t written = output.write(c);
+        stats.tx_bytes += written;
+        stats.tx_frames += (written > 0 && c == ';') ? 1 : 0;
+        return written;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        size_t written = output.write(buffer, size);
+        stats.tx_bytes += written;
+        for (size_t i = 0; i < written; i++) {
+            stats.tx_frames += (buffer[i] == ';') ? 1 : 0;
+        }
+        return written;
+    }
+};
+
+#endif
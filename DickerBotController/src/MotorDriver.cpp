@@ -0,0 +1,136 @@
+/*
+    MotorDriver.cpp - PWM output for one of the DickerBot's wheels.
+    Released into the public domain
+*/
+
+#include "MotorDriver.h"
+
+static const int FRACTION_BITS = 8;  // Ramp steps below one PWM count still add up
+
+static uint32_t RampStep(uint32_t maxDuty, uint16_t ramp_ms, uint32_t update_period_us) {
+    uint32_t fullScale = maxDuty << FRACTION_BITS;
+    if (ramp_ms == 0) {
+        return fullScale;
+    }
+    uint64_t step = (uint64_t)fullScale * update_period_us / ((uint64_t)ramp_ms * 1000);
+    return step > 0 ? (uint32_t)step : 1;
+}
+
+void MotorDriver::Begin(uint8_t enable_pin, uint8_t in1_pin, uint8_t in2_pin, uint8_t channel, const MotorDriverConfig &config, bool reversed, uint32_t update_period_us) {
+    enablePin = enable_pin;
+    in1Pin = in1_pin;
+    in2Pin = in2_pin;
+    this->channel = channel;
+    this->reversed = reversed;
+    uint8_t bits = constrain(config.pwm_resolution_bits, 1, 16);
+    maxDuty = (1u << bits) - 1;
+    rampUpStep = RampStep(maxDuty, config.ramp_up_ms, update_period_us);
+    rampDownStep = RampStep(maxDuty, config.ramp_down_ms, update_period_us);
+
+    pinMode(in1Pin, OUTPUT);
+    pinMode(in2Pin, OUTPUT);
+    ledcSetup(channel, config.pwm_frequency_hz, bits);
+    ledcAttachPin(enablePin, channel);
+    __atomic_store_n(&target, (uint32_t)MOTOR_NEUTRAL << 16, __ATOMIC_RELEASE);
+    output = 0;
+    bridgeState = -1;
+    appliedDuty = UINT32_MAX;
+    WriteDuty(0);
+    SetBridge(MOTOR_NEUTRAL);
+}
+
+void IRAM_ATTR MotorDriver::SetTarget(int speed, int direction) {
+    StoreTarget(constrain(speed, 0, MAX_SPEED), direction);
+}
+
+void IRAM_ATTR MotorDriver::SetTargetSpeed(int speed) {
+    StoreTarget(constrain(speed, 0, MAX_SPEED), KEEP);
+}
+
+void IRAM_ATTR MotorDriver::SetTargetDirection(int direction) {
+    StoreTarget(KEEP, direction);
+}
+
+void IRAM_ATTR MotorDriver::StoreTarget(int speed, int direction) {
+    // Compare-and-swap so a concurrent speed and direction change cannot undo each other
+    uint32_t current = __atomic_load_n(&target, __ATOMIC_RELAXED);
+    uint32_t desired;
+    do {
+        uint32_t newDirection = direction >= MOTOR_NEUTRAL && direction <= MOTOR_BRAKE ? (uint32_t)direction : current >> 16;  // Unknown directions leave the direction as it was
+        uint32_t newSpeed = speed != KEEP ? (uint32_t)speed : current & 0xFFFF;
+        desired = (newDirection << 16) | newSpeed;
+    } while (!__atomic_compare_exchange_n(&target, &current, desired, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void MotorDriver::Update(uint32_t periods) {
+    uint32_t command = __atomic_load_n(&target, __ATOMIC_ACQUIRE);
+    int direction = command >> 16;
+    int32_t speedDuty = (int32_t)(((command & 0xFFFF) * maxDuty / MAX_SPEED) << FRACTION_BITS);
+
+    if (direction == MOTOR_NEUTRAL || direction == MOTOR_BRAKE) {
+        // Both take effect at once: coast lets the motor spin down freely, brake stops it
+        output = 0;
+        if (direction != bridgeState) {
+            WriteDuty(0);
+            SetBridge(direction);
+        }
+        WriteDuty(direction == MOTOR_BRAKE ? speedDuty >> FRACTION_BITS : 0);
+        return;
+    }
+
+    int32_t goal = direction == MOTOR_BACKWARD ? -speedDuty : speedDuty;
+    // Periods missed while the task was delayed are caught up, never by more than full scale
+    uint64_t fullScale = (uint64_t)maxDuty << FRACTION_BITS;
+    int32_t rampUp = (int32_t)min((uint64_t)rampUpStep * periods, fullScale);
+    int32_t rampDown = (int32_t)min((uint64_t)rampDownStep * periods, fullScale);
+    bool reversing = (goal > 0 && output < 0) || (goal < 0 && output > 0);
+    if (reversing || abs(goal) < abs(output)) {
+        // Slow down, stopping at zero before a reversal
+        int32_t limit = reversing ? 0 : goal;
+        output = output > limit ? max(output - rampDown, limit) : min(output + rampDown, limit);
+    }
+    else {
+        output = output < goal ? min(output + rampUp, goal) : max(output - rampUp, goal);
+    }
+
+    int bridge = output > 0 ? MOTOR_FORWARD : (output < 0 ? MOTOR_BACKWARD : direction);
+    if (bridge != bridgeState) {
+        WriteDuty(0);  // Never switch the bridge under load
+        SetBridge(bridge);
+    }
+    WriteDuty(abs(output) >> FRACTION_BITS);
+}
+
+void MotorDriver::SetBridge(int direction) {
+    if (direction == bridgeState) {
+        return;
+    }
+    bridgeState = direction;
+    bool forwardIn1 = reversed;
+    switch (direction) {
+        case MOTOR_FORWARD:
+            digitalWrite(in1Pin, forwardIn1 ? HIGH : LOW);
+            digitalWrite(in2Pin, forwardIn1 ? LOW : HIGH);
+            break;
+        case MOTOR_BACKWARD:
+            digitalWrite(in1Pin, forwardIn1 ? LOW : HIGH);
+            digitalWrite(in2Pin, forwardIn1 ? HIGH : LOW);
+            break;
+        case MOTOR_BRAKE:
+            digitalWrite(in1Pin, HIGH);
+            digitalWrite(in2Pin, HIGH);
+            break;
+        default:
+            digitalWrite(in1Pin, LOW);
+            digitalWrite(in2Pin, LOW);
+            break;
+    }
+}
+
+void MotorDriver::WriteDuty(uint32_t duty) {
+    if (duty == appliedDuty) {
+        return;
+    }
+    appliedDuty = duty;
+    ledcWrite(channel, duty);
+}
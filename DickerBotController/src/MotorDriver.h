@@ -0,0 +1,92 @@
+/*
+    MotorDriver.h - PWM output for one of the DickerBot's wheels.
+    Released into the public domain
+
+    Drives the H-bridge enable pin from an LEDC channel, so speeds between stop and full are real,
+    and limits how fast the output may change. Update() is called from one task at a fixed rate and
+    moves the output toward the commanded state by at most one ramp step per period: speed-ups follow
+    the acceleration ramp, slow-downs the (faster) deceleration ramp, and a change of direction first
+    ramps down to zero before the bridge is switched, so the motor never reverses at full current.
+    Coast releases the motor at once; brake shorts its windings with the commanded strength.
+    The target may be set from any task or interrupt; the LEDC and GPIO writes stay in Update(), since
+    they are not safe in interrupt context.
+*/
+#ifndef MotorDriver_h
+#define MotorDriver_h
+
+#include <Arduino.h>
+
+enum MotorDirection { MOTOR_NEUTRAL = 0, MOTOR_FORWARD = 1, MOTOR_BACKWARD = 2, MOTOR_BRAKE = 3 };  // As in CD and MQ
+
+struct MotorDriverConfig {
+    uint32_t pwm_frequency_hz = 20000;  // Above hearing, within the L298N's switching range
+    uint8_t pwm_resolution_bits = 10;  // 1-16, higher resolutions need lower frequencies (80 MHz / 2^bits)
+    uint16_t ramp_up_ms = 200;  // Stop to full speed, 0 for no limit
+    uint16_t ramp_down_ms = 100;  // Full speed to stop, 0 for no limit
+};
+
+class MotorDriver {
+public:
+    static const int MAX_SPEED = 255;
+
+    /**
+     * @brief Attaches the driver to its pins and LEDC channel and stops the motor.
+     * @param enable_pin The H-bridge enable pin, driven with PWM.
+     * @param in1_pin The first H-bridge input.
+     * @param in2_pin The second H-bridge input.
+     * @param channel The LEDC channel to use.
+     * @param config The PWM and ramp settings.
+     * @param reversed Whether forward is IN1 high rather than IN2 high, for the mirrored wheel.
+     * @param update_period_us How often Update() will be called.
+     * @return void
+     */
+    void Begin(uint8_t enable_pin, uint8_t in1_pin, uint8_t in2_pin, uint8_t channel, const MotorDriverConfig &config, bool reversed, uint32_t update_period_us);
+
+    /**
+     * @brief Commands a speed and direction, reached by Update() within the ramp limits.
+     * @param speed The speed, 0-255. For MOTOR_BRAKE, the braking strength.
+     * @param direction The MotorDirection.
+     * @return void
+     */
+    void SetTarget(int speed, int direction);
+
+    /**
+     * @brief Commands a speed, keeping the commanded direction.
+     * @param speed The speed, 0-255.
+     * @return void
+     */
+    void SetTargetSpeed(int speed);
+
+    /**
+     * @brief Commands a direction, keeping the commanded speed.
+     * @param direction The MotorDirection.
+     * @return void
+     */
+    void SetTargetDirection(int direction);
+
+    /**
+     * @brief Moves the output toward the commanded state.
+     * @param periods The update periods since the last call, one ramp step each.
+     * @return void
+     * @warning Call from a single task, not from an interrupt.
+     */
+    void Update(uint32_t periods);
+
+private:
+    uint8_t enablePin = 0, in1Pin = 0, in2Pin = 0, channel = 0;
+    bool reversed = false;
+    uint32_t maxDuty = 0;
+    uint32_t rampUpStep = 0, rampDownStep = 0;  // Duty change per update, 8 fractional bits
+    uint32_t target = 0;  // Direction << 16 | speed, one atomic word so Update() never sees half a command
+    int32_t output = 0;  // Applied signed duty, 8 fractional bits
+    int bridgeState = -1;  // MotorDirection the inputs are set to
+    uint32_t appliedDuty = UINT32_MAX;
+
+    static const int KEEP = -1;
+
+    void StoreTarget(int speed, int direction);
+    void SetBridge(int direction);
+    void WriteDuty(uint32_t duty);
+};
+
+#endif
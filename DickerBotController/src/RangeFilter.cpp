@@ -0,0 +1,83 @@
+/*
+    RangeFilter.cpp - Outlier rejection and smoothing for the DickerBot's ultrasonic distance sensors.
+    Released into the public domain
+*/
+
+#include "RangeFilter.h"
+
+void RangeFilter::Configure(const RangeFilterConfig &newConfig) {
+    config = newConfig;
+    config.window = constrain(config.window, 1, RangeFilterConfig::MAX_WINDOW);
+    config.max_rate_cm_s = max(config.max_rate_cm_s, 0);
+    config.min_cm = max(config.min_cm, 0);
+    config.max_cm = max(config.max_cm, config.min_cm);
+
+    numSamples = 0;
+    nextSample = 0;
+    history = 0;
+    consecutiveRejections = 0;
+    reading = RangeReading();
+}
+
+const RangeFilterConfig &RangeFilter::GetConfig() const {
+    return config;
+}
+
+RangeReading RangeFilter::Update(int raw_cm, uint32_t timestamp_ms) {
+    history <<= 1;
+
+    if (raw_cm == 0) {
+        reading.status = RANGE_NO_ECHO;
+    }
+    else if (raw_cm < config.min_cm || raw_cm > config.max_cm) {
+        reading.status = RANGE_OUT_OF_RANGE;
+    }
+    else if (numSamples > 0 && config.max_rate_cm_s > 0 &&
+             abs(raw_cm - reading.distance_cm) > (int)((uint64_t)config.max_rate_cm_s * (timestamp_ms - lastAcceptedMs) / 1000) + GATE_SLACK_CM) {
+        // A real change persists: once most of a window disagrees, restart from the new value
+        if (++consecutiveRejections > config.window / 2) {
+            numSamples = 0;
+            nextSample = 0;
+            Accept(raw_cm, timestamp_ms);
+        }
+        else {
+            reading.status = RANGE_REJECTED;
+        }
+    }
+    else {
+        Accept(raw_cm, timestamp_ms);
+    }
+
+    uint16_t windowMask = (1u << config.window) - 1;
+    reading.confidence = __builtin_popcount(history & windowMask) * 100 / config.window;
+    if ((history & windowMask) == 0) {
+        // Nothing believable for a whole window, stop holding the old value
+        numSamples = 0;
+        nextSample = 0;
+        reading.distance_cm = 999;
+    }
+    return reading;
+}
+
+void RangeFilter::Accept(int distance_cm, uint32_t timestamp_ms) {
+    samples[nextSample] = distance_cm;
+    nextSample = (nextSample + 1) % config.window;
+    numSamples = min(numSamples + 1, config.window);
+    history |= 1;
+    consecutiveRejections = 0;
+    lastAcceptedMs = timestamp_ms;
+
+    // Insertion sort of at most MAX_WINDOW samples
+    int sorted[RangeFilterConfig::MAX_WINDOW];
+    for (int i = 0; i < numSamples; i++) {
+        int value = samples[i];
+        int j = i;
+        while (j > 0 && sorted[j - 1] > value) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+    reading.distance_cm = sorted[numSamples / 2];
+    reading.status = RANGE_OK;
+}
@@ -0,0 +1,75 @@
+/*
+    RangeFilter.h - Outlier rejection and smoothing for the DickerBot's ultrasonic distance sensors.
+    Released into the public domain
+*/
+#ifndef RangeFilter_h
+#define RangeFilter_h
+
+#include <Arduino.h>
+
+enum RangeStatus : uint8_t {
+    RANGE_OK = 0,  // Sample accepted
+    RANGE_NO_ECHO = 1,  // No echo before the ping timed out
+    RANGE_OUT_OF_RANGE = 2,  // Echo outside the configured minimum and maximum
+    RANGE_REJECTED = 3  // Jump faster than the configured rate of change
+};
+
+struct RangeFilterConfig {
+    static const int MAX_WINDOW = 9;
+    int window = 5;  // Samples in the sliding median, 1 disables it
+    int max_rate_cm_s = 200;  // Largest believable change per second, 0 disables the gate
+    int min_cm = 2;
+    int max_cm = 200;  // Pings time out beyond the controller's MAX_DISTANCE_CM
+};
+
+struct RangeReading {
+    int distance_cm = 999;  // Median of the accepted samples, held while samples are rejected, 999 when there are none
+    uint8_t status = RANGE_NO_ECHO;  // RangeStatus of the latest raw sample
+    uint8_t confidence = 0;  // Percentage of the last window of raw samples that were accepted
+};
+
+class RangeFilter {
+private:
+    static const int GATE_SLACK_CM = 2;  // Allowed jump on top of the rate limit, covers sensor jitter
+
+    RangeFilterConfig config;
+    int samples[RangeFilterConfig::MAX_WINDOW];  // Accepted samples, oldest overwritten first
+    int numSamples = 0;
+    int nextSample = 0;
+    uint16_t history = 0;  // Bit n set if the raw sample n samples ago was accepted
+    int consecutiveRejections = 0;
+    uint32_t lastAcceptedMs = 0;
+    RangeReading reading;
+
+    /**
+     * @brief Adds an accepted sample to the median window.
+     * @param distance_cm The sample.
+     * @param timestamp_ms The time the sample was taken.
+     * @return void
+     */
+    void Accept(int distance_cm, uint32_t timestamp_ms);
+
+public:
+    /**
+     * @brief Applies a configuration, clearing the filter history.
+     * @param newConfig The configuration, clamped to valid values.
+     * @return void
+     */
+    void Configure(const RangeFilterConfig &newConfig);
+
+    /**
+     * @brief Gets the applied configuration.
+     * @return The configuration.
+     */
+    const RangeFilterConfig &GetConfig() const;
+
+    /**
+     * @brief Filters one raw sample.
+     * @param raw_cm The distance reported by the sensor, 0 for no echo.
+     * @param timestamp_ms The time the sample was taken.
+     * @return The filtered reading.
+     */
+    RangeReading Update(int raw_cm, uint32_t timestamp_ms);
+};
+
+#endif
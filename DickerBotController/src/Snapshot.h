@@ -0,0 +1,68 @@
+/*
+    Snapshot.h - Lock-free latest-value sharing between the DickerBot's controller tasks.
+    Released into the public domain
+*/
+#ifndef Snapshot_h
+#define Snapshot_h
+
+#include <Arduino.h>
+
+/*
+    A sequence lock holding the latest value written by one task. The writer never blocks;
+    any number of readers copy the newest complete value and retry a few times if it changed
+    mid-copy. Reads are bounded: a reader that preempted the writer on the same core would
+    otherwise spin forever, so it gives up and tries again later.
+*/
+template <typename T>
+class Snapshot {
+private:
+    static const int READ_ATTEMPTS = 4;
+
+    T value;
+    uint32_t sequence = 0;  // Odd while the writer is writing, update count is sequence / 2
+
+public:
+    /**
+     * @brief Replaces the shared value. Owning task only.
+     * @param newValue The value to publish.
+     * @return void
+     */
+    void Publish(const T &newValue) {
+        uint32_t current = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+        __atomic_store_n(&sequence, current + 1, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        value = newValue;
+        __atomic_store_n(&sequence, current + 2, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Gets how often the value was published, without copying it.
+     * @return The update count, 0 if nothing was published yet.
+     */
+    uint32_t GetUpdateCount() {
+        return __atomic_load_n(&sequence, __ATOMIC_ACQUIRE) / 2;
+    }
+
+    /**
+     * @brief Copies the newest complete value.
+     * @param copy The value to copy into, left unchanged if no complete value could be read.
+     * @return The update count of the copied value, 0 if nothing was published yet or the writer was mid-update.
+     */
+    uint32_t Read(T &copy) {
+        for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+            uint32_t before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+            if (before & 1) {
+                continue;
+            }
+            T candidate = value;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&sequence, __ATOMIC_ACQUIRE) == before) {
+                copy = candidate;
+                return before / 2;
+            }
+        }
+        return 0;
+    }
+};
+
+#endif
@@ -0,0 +1,68 @@
+/*
+    TraceCapture.cpp - Records the DickerBot's serial link to the communicator over USB.
+    Released into the public domain
+*/
+
+#include "TraceCapture.h"
+
+const uint8_t TraceCapture::SYNC[2] = {0xDB, 0x7E};
+
+void TraceCapture::Begin(HardwareSerial &output) {
+    this->output = &output;
+}
+
+void TraceCapture::SetEnabled(bool enabled) {
+    this->enabled = enabled && output != nullptr;
+    lengths[0] = 0;
+    lengths[1] = 0;
+    gap = false;
+}
+
+bool TraceCapture::IsEnabled() const {
+    return enabled;
+}
+
+void TraceCapture::Capture(bool upstream, const uint8_t* data, size_t length) {
+    if (!enabled) {
+        return;
+    }
+
+    char* message = messages[upstream ? 1 : 0];
+    uint16_t &messageLength = lengths[upstream ? 1 : 0];
+    for (size_t i = 0; i < length; i++) {
+        if (messageLength < MAX_MESSAGE_LENGTH) {
+            message[messageLength++] = data[i];
+        }
+        else {
+            gap = true;  // Truncated, so the replay sees a damaged message rather than a clean one
+        }
+        if (data[i] == ';') {
+            WriteRecord(upstream ? TRACE_UPSTREAM : 0, message, messageLength);
+            messageLength = 0;
+        }
+    }
+}
+
+uint32_t TraceCapture::GetDropped() const {
+    return dropped;
+}
+
+void TraceCapture::WriteRecord(uint8_t flags, const char* data, uint16_t length) {
+    if (output->availableForWrite() < (int)(HEADER_SIZE + length)) {
+        dropped++;
+        gap = true;
+        return;
+    }
+
+    uint32_t timestamp = (uint32_t)esp_timer_get_time();
+    flags |= gap ? TRACE_GAP : 0;
+    uint8_t header[HEADER_SIZE] = {
+        SYNC[0], SYNC[1],
+        (uint8_t)timestamp, (uint8_t)(timestamp >> 8), (uint8_t)(timestamp >> 16), (uint8_t)(timestamp >> 24),
+        flags,
+        (uint8_t)length, (uint8_t)(length >> 8)
+    };
+    output->write(header, HEADER_SIZE);
+    output->write((const uint8_t*)data, length);
+    gap = false;
+}
@@ -0,0 +1,103 @@
+/*
+    TraceCapture.h - Records the DickerBot's serial link to the communicator over USB.
+    Released into the public domain
+
+    Every complete message in either direction is written to the computer as one record, which
+    DickerBotCommunicator/extras/TraceReplay/trace_capture.py turns into a trace file for replay.
+    A record that does not fit in the USB transmit buffer is dropped rather than stalling the
+    comms task, and the next record written is flagged as following a gap.
+
+    Record layout (little-endian): sync bytes 0xDB 0x7E, uint32 timestamp_us, uint8 TraceFlags,
+    uint16 length, then the message including its ';'.
+*/
+#ifndef TraceCapture_h
+#define TraceCapture_h
+
+#include <Arduino.h>
+
+enum TraceFlags : uint8_t {
+    TRACE_UPSTREAM = 1,  // Controller to communicator, clear for communicator to controller
+    TRACE_BINARY = 2,  // Payload is binary, only used on socket links
+    TRACE_GAP = 4  // Records were dropped before this one
+};
+
+class TraceCapture {
+public:
+    static const uint16_t MAX_MESSAGE_LENGTH = 1280;  // Longer messages are truncated and flagged
+    static const uint8_t SYNC[2];
+    static const size_t HEADER_SIZE = 9;
+
+    /**
+     * @brief Sets the port records are written to. Capture starts disabled.
+     * @param output The USB serial port, with a transmit buffer large enough for a few records.
+     * @return void
+     */
+    void Begin(HardwareSerial &output);
+
+    /**
+     * @brief Starts or stops capturing. Partial messages are discarded.
+     * @param enabled Whether to capture.
+     * @return void
+     */
+    void SetEnabled(bool enabled);
+
+    /**
+     * @brief Checks whether capture is on.
+     * @return true if capturing.
+     */
+    bool IsEnabled() const;
+
+    /**
+     * @brief Adds bytes sent over the link, writing a record for each message they complete.
+     * @param upstream true for bytes from the controller, false for bytes to it.
+     * @param data The bytes.
+     * @param length The number of bytes.
+     * @return void
+     */
+    void Capture(bool upstream, const uint8_t* data, size_t length);
+
+    /**
+     * @brief Gets the number of records dropped because the USB port was busy.
+     * @return The dropped record count since boot.
+     */
+    uint32_t GetDropped() const;
+
+private:
+    HardwareSerial* output = nullptr;
+    bool enabled = false;
+    bool gap = false;
+    uint32_t dropped = 0;
+    char messages[2][MAX_MESSAGE_LENGTH];  // Indexed by direction
+    uint16_t lengths[2] = {0, 0};
+
+    void WriteRecord(uint8_t flags, const char* data, uint16_t length);
+};
+
+/*
+    Print adapter that captures everything written through it as one direction of a link.
+*/
+class CapturingPrint : public Print {
+private:
+    Print &output;
+    TraceCapture &capture;
+    bool upstream;
+
+public:
+    CapturingPrint(Print &output, TraceCapture &capture, bool upstream) : output(output), capture(capture), upstream(upstream) {}
+
+    using Print::write;
+
+    size_t write(uint8_t c) override {
+        size_t written = output.write(c);
+        capture.Capture(upstream, &c, written);
+        return written;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        size_t written = output.write(buffer, size);
+        capture.Capture(upstream, buffer, written);
+        return written;
+    }
+};
+
+#endif
@@ -8,6 +8,17 @@ import socket
 import asyncio
 import threading
 import os
+import argparse
+import struct
+import time
+
+# trace file layout shared with DickerBotCommunicator/extras/TraceReplay
+TRACE_MAGIC = b"DBTRACE1"
+TRACE_RECORD = struct.Struct("<IBBBH") # delta_us, link, flags, endpoint, length
+TRACE_LINK_ROBOT = 1
+TRACE_LINK_CLIENT = 2
+TRACE_UPSTREAM = 1
+TRACE_BINARY = 2
 
 os.environ["QT_PLUGIN_PATH"] = os.path.join(os.path.dirname(PyQt5.__file__), "Qt", "plugins")
 
@@ -56,6 +67,16 @@ class DickerBotHost(QtWidgets.QMainWindow):
         self.server = None
         self.websocket_server = None
         self.clients = set()
+        self.robots = {} # robot id -> robot websocket
+        self.subscriptions = {} # client websocket -> set of (robot id, stream) topics
+        self.client_hellos = {} # client websocket -> {robot id: (version, encodings, sensor_hz, camera_hz)} from its hellos
+        self.robot_hellos = {} # robot id -> hello last sent to the robot on behalf of all its clients
+
+        # traffic capture for replay, see DickerBotCommunicator/extras/TraceReplay
+        self.trace_file = None
+        self.trace_lock = threading.Lock() # written from the server thread, closed from the GUI thread
+        self.trace_last_time = None
+        self.trace_endpoints = {} # websocket -> endpoint number in the trace
 
     '''
     Populates the port drop down with available ports
@@ -120,6 +141,7 @@ class DickerBotHost(QtWidgets.QMainWindow):
 
         if self.server:
             asyncio.run_coroutine_threadsafe(self.stop_websocket_server(), self.loop)
+        self.stop_trace()
 
     '''
     Runs the websocket server and continuously listens for data transfer asynchronously.
@@ -128,27 +150,48 @@ class DickerBotHost(QtWidgets.QMainWindow):
     def run_websocket_server(self):
         async def handler(websocket):
             try:
-                client_ip = websocket.remote_address[0]                
                 self.clients.add(websocket)
-                
+
                 async for message in websocket:
                     if not message.strip():
                         continue
-                    
-                    for client in list(self.clients):
-                        try:
-                            if client != websocket:
-                                await client.send(message)
-                        except Exception as e:
-                            self.clients.remove(client)
-                    for client in self.clients:
-                        if client != websocket:
-                            await client.send(message)
+
+                    prefix, robot_id = self.parse_frame_header(message)
+                    if self.trace_file:
+                        from_robot = prefix == "RD" or websocket in self.robots.values()
+                        self.record_trace(websocket, TRACE_LINK_ROBOT if from_robot else TRACE_LINK_CLIENT, from_robot, message)
+
+                    if prefix == "RD":
+                        self.robots[robot_id] = websocket
+                        self.robot_hellos.pop(robot_id, None) # the robot starts over with the original text protocol
+                        await self.negotiate_all() # until now this socket looked like a client that never said hello
+                    elif prefix == "SU":
+                        self.subscriptions.setdefault(websocket, set()).update(self.parse_topics(message, robot_id))
+                        await self.negotiate_all()
+                    elif prefix == "US":
+                        self.subscriptions.setdefault(websocket, set()).difference_update(self.parse_topics(message, robot_id))
+                        await self.negotiate_all()
+                    elif self.robots.get(robot_id) is websocket:
+                        await self.route_to_subscribers(websocket, prefix, robot_id, message)
+                    elif robot_id in self.robots:
+                        if prefix == "HL":
+                            hello = self.parse_client_hello(message)
+                            if hello:
+                                self.client_hellos.setdefault(websocket, {})[robot_id] = hello
+                                await self.negotiate(robot_id)
+                        else:
+                            await self.send_to_client(self.robots[robot_id], message)
             except Exception as e:
                 pass
             finally:
                 if websocket in self.clients:
                     self.clients.remove(websocket)
+                self.subscriptions.pop(websocket, None)
+                self.client_hellos.pop(websocket, None)
+                for robot_id in [robot_id for robot_id, robot in self.robots.items() if robot is websocket]:
+                    del self.robots[robot_id]
+                    self.robot_hellos.pop(robot_id, None)
+                await self.negotiate_all()
 
         async def start_server():
             self.server = await websockets.serve(handler, self.ip_address, int(self.port))
@@ -157,6 +200,184 @@ class DickerBotHost(QtWidgets.QMainWindow):
 
         asyncio.run(start_server())
 
+    '''
+    Splits the prefix and robot id from the header of a frame.
+    :param message: The frame, as text or bytes, in the form "prefix,robot_id,...".
+    :return: Tuple of (prefix, robot_id).
+    '''
+    def parse_frame_header(self, message):
+        header = message[:32]
+        if isinstance(header, bytes):
+            header = header.decode(errors="ignore")
+        fields = header.rstrip(";").split(",", 2)
+        prefix = fields[0]
+        robot_id = fields[1] if len(fields) > 1 else ""
+        return prefix, robot_id
+
+    '''
+    Parses the topics of a subscription frame "SU,robot_id,stream|stream;".
+    :param message: The subscription frame.
+    :param robot_id: The robot id of the subscription, "*" for all robots.
+    :return: Set of (robot_id, stream) topics, stream "*" for all streams.
+    '''
+    def parse_topics(self, message, robot_id):
+        fields = message.strip().rstrip(";").split(",")
+        streams = fields[2].split("|") if len(fields) > 2 and fields[2] else ["*"]
+        return {(robot_id, stream) for stream in streams}
+
+    '''
+    Parses a client hello "HL,robot_id,version,encodings,sensor_hz,camera_hz;".
+    :param message: The hello frame.
+    :return: Tuple of (version, set of encodings, sensor_hz, camera_hz), or None if the hello is malformed.
+    '''
+    def parse_client_hello(self, message):
+        fields = message.strip().rstrip(";").split(",")
+        try:
+            return int(fields[2]), set(fields[3].split("|")), int(fields[4]), int(fields[5])
+        except (ValueError, IndexError):
+            return None
+
+    '''
+    Gets the clients that receive a robot's sensor or camera frames.
+    :param robot_id: The robot id.
+    :return: List of client websockets.
+    '''
+    def stream_receivers(self, robot_id):
+        robot_sockets = set(self.robots.values())
+        receivers = []
+        for client in self.clients:
+            if client in robot_sockets:
+                continue
+            topics = self.subscriptions.get(client)
+            if topics is None or any((robot, stream) in topics for robot in (robot_id, "*") for stream in ("SD", "ID", "*")):
+                receivers.append(client)
+        return receivers
+
+    '''
+    Builds the hello the host sends a robot for all of its clients. The robot serves one stream, so it
+    gets the encodings every receiving client supports, the lowest protocol version and the fastest
+    requested rates (0 = maximum). If any receiving client never said hello, the hello asks for the
+    original text protocol, which every client understands.
+    :param robot_id: The robot id.
+    :return: The hello frame.
+    '''
+    def merge_hellos(self, robot_id):
+        hellos = [self.client_hellos.get(client, {}).get(robot_id) for client in self.stream_receivers(robot_id)]
+        if not hellos or None in hellos:
+            return f"HL,{robot_id},1,txt,0,0;"
+
+        version = min(hello[0] for hello in hellos)
+        encodings = set.intersection(*(hello[1] for hello in hellos)) | {"txt"}
+        sensor_hz = 0 if any(hello[2] <= 0 for hello in hellos) else max(hello[2] for hello in hellos)
+        camera_hz = 0 if any(hello[3] <= 0 for hello in hellos) else max(hello[3] for hello in hellos)
+        return f"HL,{robot_id},{version},{'|'.join(sorted(encodings))},{sensor_hz},{camera_hz};"
+
+    '''
+    Sends a robot the merged hello of its clients if it changed. The robot answers every client with NG.
+    :param robot_id: The robot id.
+    :return: None
+    '''
+    async def negotiate(self, robot_id):
+        robot = self.robots.get(robot_id)
+        if robot is None:
+            return
+
+        hello = self.merge_hellos(robot_id)
+        if hello != self.robot_hellos.get(robot_id, f"HL,{robot_id},1,txt,0,0;"):
+            self.robot_hellos[robot_id] = hello
+            await self.send_to_client(robot, hello)
+
+    '''
+    Renegotiates with every connected robot, after clients come, go or change subscriptions.
+    :return: None
+    '''
+    async def negotiate_all(self):
+        for robot_id in list(self.robots):
+            await self.negotiate(robot_id)
+
+    '''
+    Sends a robot frame to every client subscribed to its topic.
+    Clients that never subscribed receive every robot frame (legacy behaviour).
+    Binary frames are only sent to clients that said hello to the robot, as older clients only understand text;
+    a client that would have missed one makes the host renegotiate the robot down to text.
+    :param sender: The robot websocket the frame came from.
+    :param prefix: The stream of the frame.
+    :param robot_id: The robot id of the frame.
+    :param message: The frame.
+    :return: None
+    '''
+    async def route_to_subscribers(self, sender, prefix, robot_id, message):
+        robot_sockets = set(self.robots.values())
+        renegotiate = False
+        for client in list(self.clients):
+            if client is sender or client in robot_sockets:
+                continue
+
+            topics = self.subscriptions.get(client)
+            if topics is None or (robot_id, prefix) in topics or (robot_id, "*") in topics or ("*", prefix) in topics or ("*", "*") in topics:
+                if isinstance(message, bytes) and robot_id not in self.client_hellos.get(client, {}):
+                    renegotiate = True
+                    continue
+                await self.send_to_client(client, message)
+
+        if renegotiate:
+            await self.negotiate(robot_id)
+
+    '''
+    Sends a frame to a single client, dropping the client if the send fails.
+    :param client: The websocket to send to.
+    :param message: The frame.
+    :return: None
+    '''
+    async def send_to_client(self, client, message):
+        if self.trace_file:
+            to_robot = client in self.robots.values()
+            self.record_trace(client, TRACE_LINK_ROBOT if to_robot else TRACE_LINK_CLIENT, not to_robot, message)
+        try:
+            await client.send(message)
+        except Exception as e:
+            if client in self.clients:
+                self.clients.remove(client)
+
+    '''
+    Starts recording every frame the server receives and sends to a trace file.
+    :param path: The trace file to write.
+    :return: None
+    '''
+    def start_trace(self, path):
+        self.trace_file = open(path, "wb")
+        self.trace_file.write(TRACE_MAGIC)
+
+    '''
+    Stops recording and closes the trace file, so everything recorded so far is on disk.
+    :return: None
+    '''
+    def stop_trace(self):
+        with self.trace_lock:
+            if self.trace_file:
+                self.trace_file.close()
+                self.trace_file = None
+
+    '''
+    Writes a frame to the trace file.
+    :param websocket: The robot or client websocket the frame was received from or sent to.
+    :param link: TRACE_LINK_ROBOT or TRACE_LINK_CLIENT.
+    :param upstream: Whether the frame travels from the robot towards the clients.
+    :param message: The frame, as text or bytes.
+    :return: None
+    '''
+    def record_trace(self, websocket, link, upstream, message):
+        now = time.perf_counter_ns() // 1000
+        delta = 0 if self.trace_last_time is None else min(now - self.trace_last_time, 0xFFFFFFFF)
+        self.trace_last_time = now
+        endpoint = self.trace_endpoints.setdefault(websocket, len(self.trace_endpoints) % 256)
+        binary = isinstance(message, bytes)
+        data = (message if binary else message.encode())[:0xFFFF]
+        flags = (TRACE_UPSTREAM if upstream else 0) | (TRACE_BINARY if binary else 0)
+        with self.trace_lock:
+            if self.trace_file:
+                self.trace_file.write(TRACE_RECORD.pack(delta, link, flags, endpoint, len(data)) + data)
+
     '''
     Stops the websocket server asynchronously.
     :return: None
@@ -169,7 +390,15 @@ class DickerBotHost(QtWidgets.QMainWindow):
 
 
 if __name__ == "__main__":
-    app = QtWidgets.QApplication(sys.argv)
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--trace", help="Record all socket traffic to this file for replay")
+    args, qt_args = parser.parse_known_args()
+
+    app = QtWidgets.QApplication(sys.argv[:1] + qt_args)
     window = DickerBotHost()
+    if args.trace:
+        window.start_trace(args.trace)
     window.show()
-    sys.exit(app.exec_())
+    exit_code = app.exec_()
+    window.stop_trace()
+    sys.exit(exit_code)